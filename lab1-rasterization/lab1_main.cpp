@@ -351,6 +351,9 @@ int main(int argc, char* argv[])
 
 		// Swap front and back buffer. This frame will now been displayed.
 		SDL_GL_SwapWindow(g_window);
+
+		// Write out screenshots that have been read back
+		labhelper::pollScreenshots();
 	}
 
 	// Shut down everything. This includes the window and all other subsystems.
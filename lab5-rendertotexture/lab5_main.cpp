@@ -11,9 +11,11 @@
 #include <stb_image.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <string>
 #include <iostream>
+#include <thread>
 
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
@@ -24,7 +26,9 @@ using namespace glm;
 #include <imgui_impl_sdl_gl3.h>
 
 #include <Model.h>
+#include <profiler.h>
 #include "hdr.h"
+#include "noise.h"
 
 using std::min;
 using std::max;
@@ -53,6 +57,28 @@ GLuint volumetricSphereProgram;
 ///////////////////////////////////////////////////////////////////////////////
 GLuint perlinWorleyNoise;
 
+// The noise volume is only generated when these change. The settings are
+// edited in noiseSettings and applied with the "Regenerate noise" button.
+// When baked on the CPU, the volume is cached in a file and loaded from
+// there while the settings match.
+NoiseVolumeSettings noiseSettings;
+NoiseVolumeSettings appliedNoiseSettings;
+bool bakeNoiseOnCPU = true;
+NoiseVolumeSettings generatedNoiseSettings;
+bool generatedNoiseOnCPU = false;
+bool noiseVolumeGenerated = false;
+const std::string noiseCacheFilename = "perlin_worley_noise.cache";
+
+// A CPU bake runs on a worker thread, so that the UI doesn't stall, and is
+// uploaded when it is done. The thread is joinable while a bake is running.
+struct NoiseBake
+{
+	std::thread thread;
+	std::atomic<bool> done{ false };
+	NoiseVolumeSettings settings;
+	std::vector<uint8_t> voxels;
+} noiseBake;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Environment
 ///////////////////////////////////////////////////////////////////////////////
@@ -217,9 +243,10 @@ struct FboInfo
 		
 		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		// The noise tiles, so the volume can be repeated
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
 
 		///////////////////////////////////////////////////////////////////////
 		// Generate and bind framebuffer
@@ -472,6 +499,63 @@ void drawFullScreenTriangle()
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+/// Start baking the noise volume for `settings` on a worker thread (or
+/// loading it from the cache file)
+///////////////////////////////////////////////////////////////////////////////
+void startNoiseBake(const NoiseVolumeSettings& settings)
+{
+	noiseBake.settings = settings;
+	noiseBake.done = false;
+	const int size = noiseFramebuffer->depth;
+	noiseBake.thread = std::thread([size]() {
+		if(!loadNoiseVolume(noiseCacheFilename, noiseBake.settings, size, noiseBake.voxels))
+		{
+			bakeNoiseVolume(noiseBake.settings, size, noiseBake.voxels);
+			if(!saveNoiseVolume(noiseCacheFilename, noiseBake.settings, size, noiseBake.voxels))
+			{
+				std::cout << "Failed to write " << noiseCacheFilename << std::endl;
+			}
+		}
+		noiseBake.done = true;
+	});
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Render the noise volume slice by slice on the GPU. The shader is a
+/// placeholder that doesn't use the noise settings.
+///////////////////////////////////////////////////////////////////////////////
+void renderNoiseVolume()
+{
+	const int size = noiseFramebuffer->depth;
+	glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, "NOISE_GENERATION");
+	glDisable(GL_DEPTH_TEST);
+	//glEnable(GL_TEXTURE_3D); // This is causing problems
+	glBindFramebuffer(GL_FRAMEBUFFER, noiseFramebuffer->framebufferId);
+	glViewport(0, 0, noiseFramebuffer->width, noiseFramebuffer->height); // The size of the window to render
+	glClearColor(1.0f, 1.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	// Call draw
+	glUseProgram(perlinWorleyNoiseProgram); // The new pipeline definition
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_3D, noiseFramebuffer->noiseTextureTarget);
+
+	const GLint sliceLocation = glGetUniformLocation(perlinWorleyNoiseProgram, "slice");
+	for (int i = 0; i < size; i++)
+	{
+		glUniform1i(sliceLocation, i);
+		glFramebufferTexture3D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_3D,
+		                       noiseFramebuffer->noiseTextureTarget, 0, i);
+		drawFullScreenTriangle();
+	}
+
+	//glDisable(GL_TEXTURE_3D);
+	glEnable(GL_DEPTH_TEST);
+	glPopDebugGroup();
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 /// This function will be called once per frame, so the code to set up
 /// the scene for rendering should go here
@@ -479,34 +563,40 @@ void drawFullScreenTriangle()
 void display()
 {
 	///////////////////////////////////////////////////////////////////////////
-	// Noise
+	// Noise (only when the applied settings have changed). A finished CPU
+	// bake is uploaded, unless the GPU has been chosen in the meantime.
 	///////////////////////////////////////////////////////////////////////////
+	if(noiseBake.thread.joinable() && noiseBake.done)
 	{
-		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, "NOISE_GENERATION");
-		
-		glDisable(GL_DEPTH_TEST);
-		//glEnable(GL_TEXTURE_3D); // This is causing problems
-		glBindFramebuffer(GL_FRAMEBUFFER, noiseFramebuffer->framebufferId);
-		glViewport(0, 0, noiseFramebuffer->width, noiseFramebuffer->height); // The size of the window to render
-		glClearColor(1.0f, 1.0f, 0.0f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT);
-
-		// Call draw
-		glUseProgram(perlinWorleyNoiseProgram); // The new pipeline definition
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_3D, noiseFramebuffer->noiseTextureTarget);
-
-		for (size_t i = 0; i < (size_t)noiseFramebuffer->depth; i++)
+		noiseBake.thread.join();
+		if(bakeNoiseOnCPU)
 		{
-			labhelper::setUniformSlow(perlinWorleyNoiseProgram, "slice",(int)i);
-			glFramebufferTexture3D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_3D, noiseFramebuffer->noiseTextureTarget, 0, i);
-			drawFullScreenTriangle();
-			
+			PROFILE_GPU_SCOPE("Noise upload");
+			const int size = noiseFramebuffer->depth;
+			glBindTexture(GL_TEXTURE_3D, noiseFramebuffer->noiseTextureTarget);
+			glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, size, size, size, GL_RGBA, GL_UNSIGNED_BYTE,
+			                noiseBake.voxels.data());
+			noiseVolumeGenerated = true;
+			generatedNoiseSettings = noiseBake.settings;
+			generatedNoiseOnCPU = true;
+		}
+		std::vector<uint8_t>().swap(noiseBake.voxels);
+	}
+	if(bakeNoiseOnCPU)
+	{
+		const bool upToDate =
+		    noiseVolumeGenerated && generatedNoiseOnCPU && generatedNoiseSettings == appliedNoiseSettings;
+		if(!upToDate && !noiseBake.thread.joinable())
+		{
+			startNoiseBake(appliedNoiseSettings);
 		}
-
-		//glDisable(GL_TEXTURE_3D);
-		glEnable(GL_DEPTH_TEST);
-		glPopDebugGroup();
+	}
+	else if(!noiseVolumeGenerated || generatedNoiseOnCPU)
+	{
+		PROFILE_GPU_SCOPE("Noise");
+		renderNoiseVolume();
+		noiseVolumeGenerated = true;
+		generatedNoiseOnCPU = false;
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -548,6 +638,7 @@ void display()
 	///////////////////////////////////////////////////////////////////////////
 	// Bind the framebuffer to update the state machine
 	{
+		PROFILE_GPU_SCOPE("Security camera");
 		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, "OFF_SCREEN_SECURITY_CAMERA_POV");
 		glBindFramebuffer(GL_FRAMEBUFFER, fboList[0].framebufferId);
 		glViewport(0,0, fboList[0].width, fboList[0].height); // The size of the window to render
@@ -567,6 +658,7 @@ void display()
 	// draw scene from camera
 	///////////////////////////////////////////////////////////////////////////
 	{
+		PROFILE_GPU_SCOPE("Camera");
 		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, "OFF_SCREEN_CAMERA_POV");
 		glBindFramebuffer(GL_FRAMEBUFFER, fboList[1].framebufferId);
 		//glBindFramebuffer(GL_FRAMEBUFFER, 0); // to be replaced with another framebuffer when doing post processing
@@ -579,6 +671,7 @@ void display()
 		glPopDebugGroup();
 	}
 	{
+		PROFILE_GPU_SCOPE("Camera mesh");
 		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, "CAMERA_MESH");
 		// camera (obj-model)
 		drawCamera(securityCamViewMatrix, viewMatrix, projectionMatrix);
@@ -588,6 +681,7 @@ void display()
 	// Volumetric Render Pass
 	///////////////////////////////////////////////////////////////////////////
 	{
+		PROFILE_GPU_SCOPE("Volumetrics");
 		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 2, -1, "VOLUMETRIC_PASS");
 
 		glBindFramebuffer(GL_FRAMEBUFFER, volumetricSphereFramebuffer.framebufferId);
@@ -656,6 +750,7 @@ void display()
 	// The reneder data has been written in the framebuffer [1]. This is an off-screen render target that we can sample latter
 	// To render again to the screen we:
 	{
+		PROFILE_GPU_SCOPE("Composite");
 		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 2, -1, "BACKBUFFER_COMPOSITE");
 		// Bind the default frame buffer again, set the viewport and clear it
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -823,6 +918,32 @@ void gui()
 	ImGui::RadioButton("Mosaic", &currentEffect, PostProcessingEffect::Mosaic);
 	ImGui::RadioButton("Separable Blur", &currentEffect, PostProcessingEffect::Separable_blur);
 	ImGui::RadioButton("Bloom", &currentEffect, PostProcessingEffect::Bloom);
+	ImGui::Text("Noise volume");
+	ImGui::Checkbox("Bake noise on CPU", &bakeNoiseOnCPU);
+	if(bakeNoiseOnCPU)
+	{
+		int noiseSeed = int(noiseSettings.seed);
+		if(ImGui::InputInt("Noise seed", &noiseSeed))
+		{
+			noiseSettings.seed = uint32_t(noiseSeed);
+		}
+		ImGui::SliderInt("Perlin frequency", &noiseSettings.perlin_frequency, 1, 16);
+		ImGui::SliderInt("Perlin octaves", &noiseSettings.perlin_octaves, 1, 6);
+		ImGui::SliderInt("Worley frequency", &noiseSettings.worley_frequency, 1, 8);
+		if(ImGui::Button("Regenerate noise"))
+		{
+			appliedNoiseSettings = noiseSettings;
+		}
+		if(noiseBake.thread.joinable())
+		{
+			ImGui::SameLine();
+			ImGui::Text("Baking...");
+		}
+	}
+	else
+	{
+		ImGui::Text("(the GPU noise shader has no settings)");
+	}
 	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate,
 	            ImGui::GetIO().Framerate);
 	// ----------------------------------------------------------
@@ -858,13 +979,28 @@ int main(int argc, char* argv[])
 		if(showUI)
 		{
 			gui();
+			labhelper::profilerGui();
 		}
 
 		// Render the GUI.
-		ImGui::Render();
+		{
+			PROFILE_GPU_SCOPE("GUI");
+			ImGui::Render();
+		}
 
 		// Swap front and back buffer. This frame will now been displayed.
 		SDL_GL_SwapWindow(g_window);
+
+		// Write out screenshots that have been read back
+		labhelper::pollScreenshots();
+
+		// Collect this frame's timings
+		labhelper::profilerNewFrame();
+	}
+	// Let a running noise bake finish
+	if(noiseBake.thread.joinable())
+	{
+		noiseBake.thread.join();
 	}
 	// Delete Frames
 	delete noiseFramebuffer;
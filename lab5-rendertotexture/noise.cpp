@@ -0,0 +1,307 @@
+#include "noise.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+bool operator==(const NoiseVolumeSettings& a, const NoiseVolumeSettings& b)
+{
+	return a.seed == b.seed && a.perlin_frequency == b.perlin_frequency
+	       && a.perlin_octaves == b.perlin_octaves && a.worley_frequency == b.worley_frequency;
+}
+
+bool operator!=(const NoiseVolumeSettings& a, const NoiseVolumeSettings& b)
+{
+	return !(a == b);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Hash of a lattice point. Points are wrapped to the period first, which is
+// what makes the noise tile.
+///////////////////////////////////////////////////////////////////////////////
+static inline uint32_t hashLatticePoint(int x, int y, int z, int period, uint32_t seed)
+{
+	x = ((x % period) + period) % period;
+	y = ((y % period) + period) % period;
+	z = ((z % period) + period) % period;
+	uint32_t h = seed * 0x9E3779B9u ^ uint32_t(x) * 0x85EBCA6Bu ^ uint32_t(y) * 0xC2B2AE35u
+	             ^ uint32_t(z) * 0x27D4EB2Fu;
+	h ^= h >> 16;
+	h *= 0x7FEB352Du;
+	h ^= h >> 15;
+	h *= 0x846CA68Bu;
+	h ^= h >> 16;
+	return h;
+}
+
+// Each octave gets noise of its own
+static inline uint32_t octaveSeed(uint32_t seed, int frequency)
+{
+	return seed * 0x01000193u + uint32_t(frequency);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The voxel centers along one axis, at some frequency: their positions in
+// lattice units, the fractional part and its fade curve, and where each
+// lattice cell starts (cell c covers [cell_begin[c], cell_begin[c + 1])).
+///////////////////////////////////////////////////////////////////////////////
+struct NoiseAxis
+{
+	int frequency;
+	std::vector<float> position, fraction, fade;
+	std::vector<int> cell_begin;
+};
+
+static inline float fadeCurve(float t)
+{
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+static NoiseAxis makeAxis(int frequency, int size)
+{
+	NoiseAxis axis;
+	axis.frequency = frequency;
+	axis.cell_begin.assign(frequency + 1, size);
+	for(int x = size - 1; x >= 0; x--)
+	{
+		const float p = (float(x) + 0.5f) * float(frequency) / float(size);
+		const int cell = std::min(int(p), frequency - 1);
+		axis.position.push_back(p);
+		axis.cell_begin[cell] = x;
+	}
+	std::reverse(axis.position.begin(), axis.position.end());
+	// Cells too small to contain a voxel center start where the next one does
+	for(int c = frequency - 1; c >= 0; c--)
+	{
+		axis.cell_begin[c] = std::min(axis.cell_begin[c], axis.cell_begin[c + 1]);
+	}
+	for(float p : axis.position)
+	{
+		axis.fraction.push_back(p - std::floor(p));
+		axis.fade.push_back(fadeCurve(axis.fraction.back()));
+	}
+	return axis;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Add one octave of Perlin (gradient) noise, times `amplitude`, to a row of
+// voxels at lattice coordinates (y, z). Within a lattice cell the noise
+// along the row is n = A f + B + u(f) ((C - A) f + E - B), with f the
+// fraction and u its fade curve, and only A, B, C and E depend on the cell.
+///////////////////////////////////////////////////////////////////////////////
+static void addPerlinRow(const NoiseAxis& axis, uint32_t seed, float y, float z, float amplitude, float* row)
+{
+	static const float gradients[12][3] = { { 1, 1, 0 },  { -1, 1, 0 },  { 1, -1, 0 },  { -1, -1, 0 },
+		                                    { 1, 0, 1 },  { -1, 0, 1 },  { 1, 0, -1 },  { -1, 0, -1 },
+		                                    { 0, 1, 1 },  { 0, -1, 1 },  { 0, 1, -1 },  { 0, -1, -1 } };
+	const int period = axis.frequency;
+	const int iy = int(std::floor(y)), iz = int(std::floor(z));
+	const float fy = y - float(iy), fz = z - float(iz);
+	const float v = fadeCurve(fy), w = fadeCurve(fz);
+	const float* fraction = axis.fraction.data();
+	const float* fade = axis.fade.data();
+	for(int cx = 0; cx < period; cx++)
+	{
+		float A = 0.0f, B = 0.0f, C = 0.0f, E = 0.0f;
+		for(int corner = 0; corner < 4; corner++)
+		{
+			const int a = corner & 1, b = corner >> 1;
+			const float weight = (a ? v : 1.0f - v) * (b ? w : 1.0f - w);
+			const float* g0 = gradients[hashLatticePoint(cx, iy + a, iz + b, period, seed) % 12];
+			const float* g1 = gradients[hashLatticePoint(cx + 1, iy + a, iz + b, period, seed) % 12];
+			const float k0 = g0[1] * (fy - float(a)) + g0[2] * (fz - float(b));
+			const float k1 = g1[1] * (fy - float(a)) + g1[2] * (fz - float(b));
+			A += weight * g0[0];
+			B += weight * k0;
+			C += weight * g1[0];
+			E += weight * (k1 - g1[0]);
+		}
+		A *= amplitude;
+		B *= amplitude;
+		C *= amplitude;
+		E *= amplitude;
+		for(int x = axis.cell_begin[cx]; x < axis.cell_begin[cx + 1]; x++)
+		{
+			const float f = fraction[x];
+			row[x] += A * f + B + fade[x] * ((C - A) * f + E - B);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Inverted Worley (cellular) noise for a row of voxels at lattice
+// coordinates (y, z): one minus the distance to the nearest feature point,
+// with one point per cell. Within a cell, each of the 27 candidate points
+// is a constant for the whole row segment.
+///////////////////////////////////////////////////////////////////////////////
+static void worleyRow(const NoiseAxis& axis, uint32_t seed, float y, float z, float* row)
+{
+	const int period = axis.frequency;
+	const int cy = int(std::floor(y)), cz = int(std::floor(z));
+	const float* position = axis.position.data();
+	std::fill(row, row + axis.position.size(), 3.0f);
+	for(int cx = 0; cx < period; cx++)
+	{
+		const int begin = axis.cell_begin[cx], end = axis.cell_begin[cx + 1];
+		for(int neighbour = 0; neighbour < 27; neighbour++)
+		{
+			const int nx = cx + neighbour % 3 - 1;
+			const int ny = cy + (neighbour / 3) % 3 - 1;
+			const int nz = cz + neighbour / 9 - 1;
+			const uint32_t h = hashLatticePoint(nx, ny, nz, period, seed);
+			const float px = float(nx) + float(h & 0x3FF) * (1.0f / 1024.0f);
+			const float py = float(ny) + float((h >> 10) & 0x3FF) * (1.0f / 1024.0f);
+			const float pz = float(nz) + float((h >> 20) & 0x3FF) * (1.0f / 1024.0f);
+			const float dyz = (y - py) * (y - py) + (z - pz) * (z - pz);
+			for(int x = begin; x < end; x++)
+			{
+				const float dx = position[x] - px;
+				row[x] = std::min(row[x], dx * dx + dyz);
+			}
+		}
+	}
+	for(size_t x = 0; x < axis.position.size(); x++)
+	{
+		row[x] = 1.0f - std::min(std::sqrt(row[x]), 1.0f);
+	}
+}
+
+static inline uint8_t toByte(float v)
+{
+	return uint8_t(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+void bakeNoiseVolume(const NoiseVolumeSettings& settings, int size, std::vector<uint8_t>& voxels)
+{
+	voxels.resize(size_t(size) * size * size * 4);
+
+	// Perlin octaves, and the Worley frequencies (1, 2, 4, 8 and 16 times
+	// the base) that the three Worley fbms are made of
+	std::vector<NoiseAxis> perlin_axes, worley_axes;
+	float perlin_amplitude_sum = 0.0f;
+	for(int octave = 0; octave < settings.perlin_octaves; octave++)
+	{
+		perlin_axes.push_back(makeAxis(settings.perlin_frequency << octave, size));
+		perlin_amplitude_sum += 1.0f / float(1 << octave);
+	}
+	const int worley_octaves = 5;
+	for(int octave = 0; octave < worley_octaves; octave++)
+	{
+		worley_axes.push_back(makeAxis(settings.worley_frequency << octave, size));
+	}
+
+	std::atomic<int> next_slice(0);
+	auto worker = [&]() {
+		std::vector<float> perlin(size), worley(size_t(size) * worley_octaves);
+		for(int z = next_slice++; z < size; z = next_slice++)
+		{
+			for(int y = 0; y < size; y++)
+			{
+				std::fill(perlin.begin(), perlin.end(), 0.0f);
+				for(int octave = 0; octave < settings.perlin_octaves; octave++)
+				{
+					const NoiseAxis& axis = perlin_axes[octave];
+					const float amplitude = 1.0f / (float(1 << octave) * perlin_amplitude_sum);
+					addPerlinRow(axis, octaveSeed(settings.seed, axis.frequency), axis.position[y],
+					             axis.position[z], amplitude, perlin.data());
+				}
+				for(int octave = 0; octave < worley_octaves; octave++)
+				{
+					const NoiseAxis& axis = worley_axes[octave];
+					worleyRow(axis, octaveSeed(settings.seed, -axis.frequency), axis.position[y],
+					          axis.position[z], &worley[size_t(octave) * size]);
+				}
+				uint8_t* out = &voxels[((size_t(z) * size + y) * size) * 4];
+				for(int x = 0; x < size; x++)
+				{
+					float fbm[3];
+					for(int channel = 0; channel < 3; channel++)
+					{
+						const float* w = &worley[size_t(channel) * size + x];
+						fbm[channel] = 0.625f * w[0] + 0.25f * w[size] + 0.125f * w[2 * size];
+					}
+					const float p = std::min(std::max(0.5f + 0.5f * perlin[x], 0.0f), 1.0f);
+					out[x * 4 + 0] = toByte(fbm[0] + p * (1.0f - fbm[0]));
+					out[x * 4 + 1] = toByte(fbm[0]);
+					out[x * 4 + 2] = toByte(fbm[1]);
+					out[x * 4 + 3] = toByte(fbm[2]);
+				}
+			}
+		}
+	};
+	const int thread_count = std::max(1, std::min(int(std::thread::hardware_concurrency()), size));
+	std::vector<std::thread> threads;
+	for(int i = 1; i < thread_count; i++)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for(auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The cache file is this header followed by the voxels
+///////////////////////////////////////////////////////////////////////////////
+struct NoiseCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	int32_t size;
+	uint32_t seed;
+	int32_t perlin_frequency;
+	int32_t perlin_octaves;
+	int32_t worley_frequency;
+};
+// Bump whenever the header or the noise itself changes
+static const uint32_t noise_cache_version = 1;
+static const char noise_cache_magic[8] = { 'P', 'W', 'N', 'O', 'I', 'S', 'E', '\0' };
+
+static NoiseCacheHeader makeHeader(const NoiseVolumeSettings& settings, int size)
+{
+	NoiseCacheHeader header;
+	memcpy(header.magic, noise_cache_magic, sizeof(header.magic));
+	header.version = noise_cache_version;
+	header.size = size;
+	header.seed = settings.seed;
+	header.perlin_frequency = settings.perlin_frequency;
+	header.perlin_octaves = settings.perlin_octaves;
+	header.worley_frequency = settings.worley_frequency;
+	return header;
+}
+
+bool loadNoiseVolume(const std::string& filename,
+                     const NoiseVolumeSettings& settings,
+                     int size,
+                     std::vector<uint8_t>& voxels)
+{
+	std::ifstream file(filename, std::ios::binary);
+	NoiseCacheHeader header;
+	if(!file.read((char*)&header, sizeof(header)))
+	{
+		return false;
+	}
+	const NoiseCacheHeader expected = makeHeader(settings, size);
+	if(memcmp(&header, &expected, sizeof(header)) != 0)
+	{
+		return false;
+	}
+	voxels.resize(size_t(size) * size * size * 4);
+	return bool(file.read((char*)voxels.data(), voxels.size()));
+}
+
+bool saveNoiseVolume(const std::string& filename,
+                     const NoiseVolumeSettings& settings,
+                     int size,
+                     const std::vector<uint8_t>& voxels)
+{
+	std::ofstream file(filename, std::ios::binary);
+	const NoiseCacheHeader header = makeHeader(settings, size);
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)voxels.data(), voxels.size());
+	return bool(file);
+}
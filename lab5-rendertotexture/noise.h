@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+/// Parameters of the tileable Perlin-Worley noise volume used for the
+/// volumetrics. Frequencies are in lattice cells across the volume, which
+/// wraps around in all three directions.
+///////////////////////////////////////////////////////////////////////////////
+struct NoiseVolumeSettings
+{
+	uint32_t seed = 1;
+	// Perlin fbm: frequency of the first octave, and number of octaves
+	int perlin_frequency = 4;
+	int perlin_octaves = 5;
+	// Frequency of the lowest Worley fbm (in the red and green channels).
+	// Blue and alpha have two and four times the frequency.
+	int worley_frequency = 4;
+};
+bool operator==(const NoiseVolumeSettings& a, const NoiseVolumeSettings& b);
+bool operator!=(const NoiseVolumeSettings& a, const NoiseVolumeSettings& b);
+
+///////////////////////////////////////////////////////////////////////////////
+/// Bake size^3 RGBA8 voxels (x fastest, then y, then z) on the CPU:
+///   R: Perlin-Worley (Perlin fbm remapped to [worley, 1])
+///   G, B, A: Worley fbm of increasing frequency
+/// Slices are spread over all cores, and the inner loops run along rows of
+/// voxels within a lattice cell, so that the compiler vectorizes them.
+///////////////////////////////////////////////////////////////////////////////
+void bakeNoiseVolume(const NoiseVolumeSettings& settings, int size, std::vector<uint8_t>& voxels);
+
+///////////////////////////////////////////////////////////////////////////////
+/// A cache file of a baked volume. Loading fails (returns false) if the file
+/// doesn't exist or was baked with other settings or size.
+///////////////////////////////////////////////////////////////////////////////
+bool loadNoiseVolume(const std::string& filename,
+                     const NoiseVolumeSettings& settings,
+                     int size,
+                     std::vector<uint8_t>& voxels);
+bool saveNoiseVolume(const std::string& filename,
+                     const NoiseVolumeSettings& settings,
+                     int size,
+                     const std::vector<uint8_t>& voxels);
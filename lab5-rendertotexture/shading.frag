@@ -6,15 +6,19 @@ precision highp float;
 ///////////////////////////////////////////////////////////////////////////////
 // Material
 ///////////////////////////////////////////////////////////////////////////////
-uniform vec3 material_color;
-uniform float material_metalness;
-uniform float material_fresnel;
-uniform float material_shininess;
-uniform vec3 material_emission;
+// Filled in by labhelper::render from the model's material buffer
+layout(std140) uniform MaterialBlock
+{
+	vec3 material_color;
+	float material_metalness;
+	vec3 material_emission;
+	float material_fresnel;
+	float material_shininess;
+	int has_color_texture;
+	int has_emission_texture;
+};
 
-uniform int has_color_texture;
 layout(binding = 0) uniform sampler2D colorMap;
-uniform int has_emission_texture;
 layout(binding = 5) uniform sampler2D emissiveMap;
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1,12 +1,19 @@
 #include "Model.h"
+#include "ModelCache.h"
+#include "ObjParser.h"
 #include "labhelper.h"
 #include <iostream>
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
 #include <tiny_obj_loader.h>
 //#include <experimental/tinyobj_loader_opt.h>
 #include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <sstream>
 #include <iomanip>
+#include <unordered_map>
+#include <cstring>
+#include <thread>
 #include <GL/glew.h>
 #include <stb_image.h>
 
@@ -26,7 +33,10 @@ void Texture::free()
 	}
 }
 
-bool Texture::load(const std::string& _directory, const std::string& _filename, int _components)
+bool Texture::load(const std::string& _directory,
+                   const std::string& _filename,
+                   int _components,
+                   bool upload_to_gpu)
 {
 	filename = file::normalise(_filename);
 	directory = file::normalise(_directory);
@@ -39,11 +49,15 @@ bool Texture::load(const std::string& _directory, const std::string& _filename,
 		          << "\n";
 		exit(1);
 	}
+	n_components = _components;
+	if(!upload_to_gpu)
+	{
+		return true;
+	}
 	glGenTextures(1, &gl_id_internal);
 	gl_id = gl_id_internal;
 	glBindTexture(GL_TEXTURE_2D, gl_id_internal);
 	GLenum format, internal_format;
-	n_components = _components;
 	if(_components == 1)
 	{
 		format = GL_R;
@@ -78,21 +92,23 @@ bool Texture::load(const std::string& _directory, const std::string& _filename,
 
 glm::vec4 Texture::sample(glm::vec2 uv) const
 {
-	int x = int(uv.x * width + 0.5) % width;
-	int y = int(uv.y * height + 0.5) % height;
-	if(n_components == 4)
-	{
-		return glm::vec4(data[(y * width + x) * 4 + 0], data[(y * width + x) * 4 + 1],
-		                 data[(y * width + x) * 4 + 2], data[(y * width + x) * 4 + 3])
-		       / 255.f;
-	}
-	else
-	{
-		// Just return one channel
-		return glm::vec4(data[(y * width + x) * n_components + 0], data[(y * width + x) * n_components + 0],
-		                 data[(y * width + x) * n_components + 0], data[(y * width + x) * n_components + 0])
-		       / 255.f;
-	}
+	// Bilinear interpolation between the four closest texels (whose
+	// centers are at half integer coordinates), repeating the texture
+	const float x = uv.x * width - 0.5f;
+	const float y = uv.y * height - 0.5f;
+	const float fx = std::floor(x), fy = std::floor(y);
+	const float tx = x - fx, ty = y - fy;
+	auto repeat = [](int i, int size) { return ((i % size) + size) % size; };
+	const int x0 = repeat(int(fx), width), x1 = repeat(int(fx) + 1, width);
+	const int y0 = repeat(int(fy), height), y1 = repeat(int(fy) + 1, height);
+	auto texel = [this](int tx, int ty) {
+		const uint8_t* t = &data[(ty * width + tx) * n_components];
+		// With fewer than four components, just return the first channel
+		return n_components == 4 ? glm::vec4(t[0], t[1], t[2], t[3]) : glm::vec4(t[0]);
+	};
+	const glm::vec4 bottom = glm::mix(texel(x0, y0), texel(x1, y0), tx);
+	const glm::vec4 top = glm::mix(texel(x0, y1), texel(x1, y1), tx);
+	return glm::mix(bottom, top, ty) / 255.f;
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -113,38 +129,185 @@ Model::~Model()
 		if(material.m_emission_texture.valid)
 			material.m_emission_texture.free();
 	}
-	glDeleteBuffers(1, &m_positions_bo);
-	glDeleteBuffers(1, &m_normals_bo);
-	glDeleteBuffers(1, &m_texture_coordinates_bo);
+	if(m_vaob != 0)
+	{
+		glDeleteBuffers(1, &m_positions_bo);
+		glDeleteBuffers(1, &m_normals_bo);
+		glDeleteBuffers(1, &m_texture_coordinates_bo);
+		glDeleteBuffers(1, &m_indices_bo);
+		glDeleteBuffers(1, &m_materials_ubo);
+		glDeleteVertexArrays(1, &m_vaob);
+	}
 }
 
 
-Model* loadModelFromOBJ(std::string path)
+///////////////////////////////////////////////////////////////////////
+// Hashing of tinyobj's (position, normal, texcoord) index triplets, used
+// to weld the corners of the triangles into shared vertices
+///////////////////////////////////////////////////////////////////////
+struct ObjIndexHash
 {
-	std::string filename, extension, directory;
+	size_t operator()(const tinyobj::index_t& idx) const
+	{
+		size_t hash = size_t(uint32_t(idx.vertex_index)) * 73856093u;
+		hash ^= size_t(uint32_t(idx.normal_index)) * 19349663u;
+		hash ^= size_t(uint32_t(idx.texcoord_index)) * 83492791u;
+		return hash;
+	}
+};
 
-	filename = file::normalise(path);
-	directory = file::parent_path(path);
-	filename = file::file_stem(path);
-	extension = file::file_extension(path);
+struct ObjIndexEqual
+{
+	bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const
+	{
+		return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index
+		       && a.texcoord_index == b.texcoord_index;
+	}
+};
 
-	if(extension != ".obj")
+///////////////////////////////////////////////////////////////////////
+// The meshes of one shape, with vertex streams and indices of their own,
+// so that shapes can be processed in parallel. Offsets are relative to
+// the shape until the results are concatenated.
+///////////////////////////////////////////////////////////////////////
+struct ShapeMeshes
+{
+	std::vector<Mesh> meshes;
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texture_coordinates;
+	std::vector<uint32_t> indices;
+};
+
+///////////////////////////////////////////////////////////////////////
+// Turn a shape into Meshes. A shape that has several materials will be
+// split into several meshes with unique names.
+///////////////////////////////////////////////////////////////////////
+static void buildShapeMeshes(const tinyobj::shape_t& shape,
+                             const tinyobj::attrib_t& attrib,
+                             const std::vector<tinyobj::material_t>& materials,
+                             const std::vector<glm::vec4>& auto_normals,
+                             ShapeMeshes& result)
+{
+	std::unordered_map<tinyobj::index_t, uint32_t, ObjIndexHash, ObjIndexEqual> welded_vertices;
+	///////////////////////////////////////////////////////////////////
+	// The shapes in an OBJ file may several different materials.
+	// If so, we will split the shape into one Mesh per Material
+	///////////////////////////////////////////////////////////////////
+	int next_material_index = shape.mesh.material_ids[0];
+	int next_material_starting_face = 0;
+	std::vector<bool> finished_materials(materials.size(), false);
+	int number_of_materials_in_shape = 0;
+	while(next_material_index != -1)
 	{
-		std::cout << "Fatal: loadModelFromOBJ(): Expecting filename ending in '.obj'\n";
-		exit(1);
+		int current_material_index = next_material_index;
+		int current_material_starting_face = next_material_starting_face;
+		next_material_index = -1;
+		next_material_starting_face = -1;
+		// Process a new Mesh with a unique material
+		Mesh mesh;
+		mesh.m_name = shape.name + "_" + materials[current_material_index].name;
+		mesh.m_material_idx = current_material_index;
+		mesh.m_start_index = uint32_t(result.indices.size());
+		mesh.m_base_vertex = uint32_t(result.positions.size());
+		number_of_materials_in_shape += 1;
+		welded_vertices.clear();
+
+		uint64_t number_of_faces = shape.mesh.indices.size() / 3;
+		for(int i = current_material_starting_face; i < number_of_faces; i++)
+		{
+			if(shape.mesh.material_ids[i] != current_material_index)
+			{
+				if(next_material_index >= 0)
+					continue;
+				else if(finished_materials[shape.mesh.material_ids[i]])
+					continue;
+				else
+				{ // Found a new material that we have not processed.
+					next_material_index = shape.mesh.material_ids[i];
+					next_material_starting_face = i;
+				}
+			}
+			else
+			{
+				///////////////////////////////////////////////////////
+				// Now we generate the vertices, welding corners that
+				// share position, normal and texture coordinate.
+				///////////////////////////////////////////////////////
+				for(int j = 0; j < 3; j++)
+				{
+					const tinyobj::index_t& idx = shape.mesh.indices[i * 3 + j];
+					const uint32_t next_vertex = uint32_t(result.positions.size()) - mesh.m_base_vertex;
+					auto inserted = welded_vertices.insert({ idx, next_vertex });
+					result.indices.push_back(inserted.first->second);
+					if(!inserted.second)
+					{
+						continue;
+					}
+					result.positions.push_back(glm::vec3(attrib.vertices[idx.vertex_index * 3 + 0],
+					                                     attrib.vertices[idx.vertex_index * 3 + 1],
+					                                     attrib.vertices[idx.vertex_index * 3 + 2]));
+					if(idx.normal_index == -1)
+					{
+						// No normal, use the autogenerated
+						result.normals.push_back(glm::vec3(auto_normals[idx.vertex_index]));
+					}
+					else
+					{
+						result.normals.push_back(glm::vec3(attrib.normals[idx.normal_index * 3 + 0],
+						                                   attrib.normals[idx.normal_index * 3 + 1],
+						                                   attrib.normals[idx.normal_index * 3 + 2]));
+					}
+					if(idx.texcoord_index == -1)
+					{
+						// No UV coordinates. Use null.
+						result.texture_coordinates.push_back(glm::vec2(0.0f));
+					}
+					else
+					{
+						result.texture_coordinates.push_back(
+						    glm::vec2(attrib.texcoords[idx.texcoord_index * 2 + 0],
+						              attrib.texcoords[idx.texcoord_index * 2 + 1]));
+					}
+				}
+			}
+		}
+		///////////////////////////////////////////////////////////////
+		// Finalize and push this mesh to the list
+		///////////////////////////////////////////////////////////////
+		mesh.m_number_of_indices = uint32_t(result.indices.size()) - mesh.m_start_index;
+		mesh.m_number_of_vertices = uint32_t(result.positions.size()) - mesh.m_base_vertex;
+		result.meshes.push_back(mesh);
+		finished_materials[current_material_index] = true;
+	}
+	if(number_of_materials_in_shape == 1)
+	{
+		// If there's only one material, we don't need the material name in the mesh name
+		result.meshes.back().m_name = shape.name;
 	}
+}
 
+///////////////////////////////////////////////////////////////////////
+// Parse an OBJ file (and its materials) into a Model. The material
+// library files it looked for are added to `material_libraries`.
+///////////////////////////////////////////////////////////////////////
+static Model* parseOBJ(const std::string& path,
+                       const std::string& directory,
+                       const std::string& filename,
+                       const std::string& extension,
+                       bool upload_to_gpu,
+                       std::vector<std::string>& material_libraries)
+{
 	///////////////////////////////////////////////////////////////////////
-	// Parse the OBJ file using tinyobj
+	// Parse the OBJ file (triangulated) in parallel
 	///////////////////////////////////////////////////////////////////////
-	std::cout << "Loading " << path << "..." << std::flush;
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
 	std::string err;
-	// Expect '.mtl' file in the same directory and triangulate meshes
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err,
-	                            (directory + filename + extension).c_str(), directory.c_str(), true);
+	// Expect '.mtl' file in the same directory
+	bool ret = loadObjParallel(&attrib, &shapes, &materials, &err, directory + filename + extension,
+	                           directory, &material_libraries);
 	if(!err.empty())
 	{ // `err` may contain warning message.
 		std::cerr << err << std::endl;
@@ -167,27 +330,27 @@ Model* loadModelFromOBJ(std::string path)
 		material.m_color = glm::vec3(m.diffuse[0], m.diffuse[1], m.diffuse[2]);
 		if(m.diffuse_texname != "")
 		{
-			material.m_color_texture.load(directory, m.diffuse_texname, 4);
+			material.m_color_texture.load(directory, m.diffuse_texname, 4, upload_to_gpu);
 		}
 		material.m_metalness = m.metallic;
 		if(m.metallic_texname != "")
 		{
-			material.m_metalness_texture.load(directory, m.metallic_texname, 1);
+			material.m_metalness_texture.load(directory, m.metallic_texname, 1, upload_to_gpu);
 		}
 		material.m_fresnel = m.specular[0];
 		if(m.specular_texname != "")
 		{
-			material.m_fresnel_texture.load(directory, m.specular_texname, 1);
+			material.m_fresnel_texture.load(directory, m.specular_texname, 1, upload_to_gpu);
 		}
 		material.m_shininess = m.roughness;
 		if(m.roughness_texname != "")
 		{
-			material.m_shininess_texture.load(directory, m.roughness_texname, 1);
+			material.m_shininess_texture.load(directory, m.roughness_texname, 1, upload_to_gpu);
 		}
 		material.m_emission = glm::vec3(m.emission[0], m.emission[1], m.emission[2]);
 		if(m.emissive_texname != "")
 		{
-			material.m_emission_texture.load(directory, m.emissive_texname, 4);
+			material.m_emission_texture.load(directory, m.emissive_texname, 4, upload_to_gpu);
 		}
 		material.m_transparency = m.transmittance[0];
 		material.m_ior = m.ior;
@@ -196,17 +359,15 @@ Model* loadModelFromOBJ(std::string path)
 
 	///////////////////////////////////////////////////////////////////////
 	// A vertex in the OBJ file may have different indices for position,
-	// normal and texture coordinate. We will not even attempt to use
-	// indexed lookups, but will store a simple vertex stream per mesh.
+	// normal and texture coordinate. Each unique combination becomes one
+	// vertex of the mesh it is used in (see below).
 	///////////////////////////////////////////////////////////////////////
-	uint64_t number_of_vertices = 0;
+	uint64_t number_of_indices = 0;
 	for(const auto& shape : shapes)
 	{
-		number_of_vertices += shape.mesh.indices.size();
+		number_of_indices += shape.mesh.indices.size();
 	}
-	model->m_positions.resize(number_of_vertices);
-	model->m_normals.resize(number_of_vertices);
-	model->m_texture_coordinates.resize(number_of_vertices);
+	model->m_indices.reserve(number_of_indices);
 
 	///////////////////////////////////////////////////////////////////////
 	// For each vertex _position_ auto generate a normal that will be used
@@ -242,106 +403,71 @@ Model* loadModelFromOBJ(std::string path)
 	}
 
 	///////////////////////////////////////////////////////////////////////
-	// Now we will turn all shapes into Meshes. A shape that has several
-	// materials will be split into several meshes with unique names
+	// Now we will turn all shapes into Meshes, on as many threads as
+	// there are cores, and then concatenate them in order.
 	///////////////////////////////////////////////////////////////////////
-	int vertices_so_far = 0;
-	for(int s = 0; s < shapes.size(); ++s)
-	{
-		const auto& shape = shapes[s];
-		///////////////////////////////////////////////////////////////////
-		// The shapes in an OBJ file may several different materials.
-		// If so, we will split the shape into one Mesh per Material
-		///////////////////////////////////////////////////////////////////
-		int next_material_index = shape.mesh.material_ids[0];
-		int next_material_starting_face = 0;
-		std::vector<bool> finished_materials(materials.size(), false);
-		int number_of_materials_in_shape = 0;
-		while(next_material_index != -1)
-		{
-			int current_material_index = next_material_index;
-			int current_material_starting_face = next_material_starting_face;
-			next_material_index = -1;
-			next_material_starting_face = -1;
-			// Process a new Mesh with a unique material
-			Mesh mesh;
-			mesh.m_name = shape.name + "_" + materials[current_material_index].name;
-			mesh.m_material_idx = current_material_index;
-			mesh.m_start_index = vertices_so_far;
-			number_of_materials_in_shape += 1;
-
-			uint64_t number_of_faces = shape.mesh.indices.size() / 3;
-			for(int i = current_material_starting_face; i < number_of_faces; i++)
+	std::vector<ShapeMeshes> shape_meshes(shapes.size());
+	{
+		std::atomic<size_t> next_shape(0);
+		auto worker = [&]() {
+			for(size_t s = next_shape++; s < shapes.size(); s = next_shape++)
 			{
-				if(shape.mesh.material_ids[i] != current_material_index)
-				{
-					if(next_material_index >= 0)
-						continue;
-					else if(finished_materials[shape.mesh.material_ids[i]])
-						continue;
-					else
-					{ // Found a new material that we have not processed.
-						next_material_index = shape.mesh.material_ids[i];
-						next_material_starting_face = i;
-					}
-				}
-				else
-				{
-					///////////////////////////////////////////////////////
-					// Now we generate the vertices
-					///////////////////////////////////////////////////////
-					for(int j = 0; j < 3; j++)
-					{
-						int v = shape.mesh.indices[i * 3 + j].vertex_index;
-						model->m_positions[vertices_so_far + j] =
-						    glm::vec3(attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 0],
-						              attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 1],
-						              attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 2]);
-						if(shape.mesh.indices[i * 3 + j].normal_index == -1)
-						{
-							// No normal, use the autogenerated
-							model->m_normals[vertices_so_far + j] = glm::vec3(
-							    auto_normals[shape.mesh.indices[i * 3 + j].vertex_index]);
-						}
-						else
-						{
-							model->m_normals[vertices_so_far + j] =
-							    glm::vec3(attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 0],
-							              attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 1],
-							              attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 2]);
-						}
-						if(shape.mesh.indices[i * 3 + j].texcoord_index == -1)
-						{
-							// No UV coordinates. Use null.
-							model->m_texture_coordinates[vertices_so_far + j] = glm::vec2(0.0f);
-						}
-						else
-						{
-							model->m_texture_coordinates[vertices_so_far + j] = glm::vec2(
-							    attrib.texcoords[shape.mesh.indices[i * 3 + j].texcoord_index * 2 + 0],
-							    attrib.texcoords[shape.mesh.indices[i * 3 + j].texcoord_index * 2 + 1]);
-						}
-					}
-					vertices_so_far += 3;
-				}
+				buildShapeMeshes(shapes[s], attrib, materials, auto_normals, shape_meshes[s]);
 			}
-			///////////////////////////////////////////////////////////////
-			// Finalize and push this mesh to the list
-			///////////////////////////////////////////////////////////////
-			mesh.m_number_of_vertices = vertices_so_far - mesh.m_start_index;
-			model->m_meshes.push_back(mesh);
-			finished_materials[current_material_index] = true;
+		};
+		const size_t thread_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+		                                             shapes.size());
+		std::vector<std::thread> threads;
+		for(size_t i = 1; i < thread_count; i++)
+		{
+			threads.emplace_back(worker);
 		}
-		if(number_of_materials_in_shape == 1)
+		worker();
+		for(auto& thread : threads)
+		{
+			thread.join();
+		}
+	}
+	size_t number_of_vertices = 0;
+	for(const auto& result : shape_meshes)
+	{
+		number_of_vertices += result.positions.size();
+	}
+	model->m_positions.reserve(number_of_vertices + 1);
+	model->m_normals.reserve(number_of_vertices);
+	model->m_texture_coordinates.reserve(number_of_vertices);
+	for(auto& result : shape_meshes)
+	{
+		for(Mesh mesh : result.meshes)
 		{
-			// If there's only one material, we don't need the material name in the mesh name
-			model->m_meshes.back().m_name = shape.name;
+			mesh.m_start_index += uint32_t(model->m_indices.size());
+			mesh.m_base_vertex += uint32_t(model->m_positions.size());
+			model->m_meshes.push_back(mesh);
 		}
+		model->m_indices.insert(model->m_indices.end(), result.indices.begin(), result.indices.end());
+		model->m_positions.insert(model->m_positions.end(), result.positions.begin(), result.positions.end());
+		model->m_normals.insert(model->m_normals.end(), result.normals.begin(), result.normals.end());
+		model->m_texture_coordinates.insert(model->m_texture_coordinates.end(),
+		                                    result.texture_coordinates.begin(),
+		                                    result.texture_coordinates.end());
+		result = ShapeMeshes();
 	}
+	model->m_number_of_vertices = uint32_t(model->m_positions.size());
+	model->m_positions.push_back(glm::vec3(0.0f));
+	model->m_normals.shrink_to_fit();
+	model->m_texture_coordinates.shrink_to_fit();
 
 	std::sort(model->m_meshes.begin(), model->m_meshes.end(),
 	          [](const Mesh& a, const Mesh& b) { return a.m_name < b.m_name; });
 
+	return model;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Upload the vertex streams of a model to the GPU
+///////////////////////////////////////////////////////////////////////
+static void uploadModelToGPU(Model* model)
+{
 	///////////////////////////////////////////////////////////////////////
 	// Upload to GPU
 	///////////////////////////////////////////////////////////////////////
@@ -349,7 +475,7 @@ Model* loadModelFromOBJ(std::string path)
 	glBindVertexArray(model->m_vaob);
 	glGenBuffers(1, &model->m_positions_bo);
 	glBindBuffer(GL_ARRAY_BUFFER, model->m_positions_bo);
-	glBufferData(GL_ARRAY_BUFFER, model->m_positions.size() * sizeof(glm::vec3), &model->m_positions[0].x,
+	glBufferData(GL_ARRAY_BUFFER, model->m_number_of_vertices * sizeof(glm::vec3), &model->m_positions[0].x,
 	             GL_STATIC_DRAW);
 	glVertexAttribPointer(0, 3, GL_FLOAT, false, 0, 0);
 	glEnableVertexAttribArray(0);
@@ -366,8 +492,70 @@ Model* loadModelFromOBJ(std::string path)
 	glVertexAttribPointer(2, 2, GL_FLOAT, false, 0, 0);
 	glEnableVertexAttribArray(2);
 
+	///////////////////////////////////////////////////////////////////////
+	// Indices are relative to each mesh's base vertex, so 16 bits are
+	// enough unless some mesh has more than 65536 vertices
+	///////////////////////////////////////////////////////////////////////
+	uint32_t max_vertices_per_mesh = 0;
+	for(const auto& mesh : model->m_meshes)
+	{
+		max_vertices_per_mesh = std::max(max_vertices_per_mesh, mesh.m_number_of_vertices);
+	}
+	glGenBuffers(1, &model->m_indices_bo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->m_indices_bo);
+	if(max_vertices_per_mesh <= 65536)
+	{
+		std::vector<uint16_t> indices(model->m_indices.begin(), model->m_indices.end());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(),
+		             GL_STATIC_DRAW);
+		model->m_index_type = GL_UNSIGNED_SHORT;
+	}
+	else
+	{
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, model->m_indices.size() * sizeof(uint32_t),
+		             model->m_indices.data(), GL_STATIC_DRAW);
+		model->m_index_type = GL_UNSIGNED_INT;
+	}
+
 	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	updateMaterialBuffer(model);
+}
+
+Model* loadModelFromOBJ(std::string path, bool upload_to_gpu)
+{
+	std::string filename, extension, directory;
+
+	filename = file::normalise(path);
+	directory = file::parent_path(path);
+	filename = file::file_stem(path);
+	extension = file::file_extension(path);
+
+	if(extension != ".obj")
+	{
+		std::cout << "Fatal: loadModelFromOBJ(): Expecting filename ending in '.obj'\n";
+		exit(1);
+	}
+
+	std::cout << "Loading " << path << "..." << std::flush;
+	///////////////////////////////////////////////////////////////////////
+	// Use the binary cache if it is up to date with the OBJ file,
+	// otherwise parse the OBJ file and (re)write the cache.
+	///////////////////////////////////////////////////////////////////////
+	Model* model = loadModelCache(path, upload_to_gpu);
+	if(model == nullptr)
+	{
+		std::vector<std::string> material_libraries;
+		model = parseOBJ(path, directory, filename, extension, upload_to_gpu, material_libraries);
+		saveModelCache(model, path, material_libraries);
+	}
+
+	if(upload_to_gpu)
+	{
+		uploadModelToGPU(model);
+	}
 
 	std::cout << "done.\n";
 	return model;
@@ -443,29 +631,32 @@ void saveModelToOBJ(Model* model, std::string filename)
 		obj_file << "o " << mesh.m_name << "\n";
 		obj_file << "g " << mesh.m_name << "\n";
 		obj_file << "usemtl " << model->m_materials[mesh.m_material_idx].m_name << "\n";
-		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		for(uint32_t i = mesh.m_base_vertex; i < mesh.m_base_vertex + mesh.m_number_of_vertices; i++)
 		{
 			obj_file << "v " << model->m_positions[i].x << " " << model->m_positions[i].y << " "
 			         << model->m_positions[i].z << "\n";
 		}
-		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		for(uint32_t i = mesh.m_base_vertex; i < mesh.m_base_vertex + mesh.m_number_of_vertices; i++)
 		{
 			obj_file << "vn " << model->m_normals[i].x << " " << model->m_normals[i].y << " "
 			         << model->m_normals[i].z << "\n";
 		}
-		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		for(uint32_t i = mesh.m_base_vertex; i < mesh.m_base_vertex + mesh.m_number_of_vertices; i++)
 		{
 			obj_file << "vt " << model->m_texture_coordinates[i].x << " " << model->m_texture_coordinates[i].y
 			         << "\n";
 		}
-		int number_of_faces = mesh.m_number_of_vertices / 3;
-		for(int i = 0; i < number_of_faces; i++)
+		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_indices; i += 3)
 		{
-			obj_file << "f " << vertex_counter << "/" << vertex_counter << "/" << vertex_counter << " "
-			         << vertex_counter + 1 << "/" << vertex_counter + 1 << "/" << vertex_counter + 1 << " "
-			         << vertex_counter + 2 << "/" << vertex_counter + 2 << "/" << vertex_counter + 2 << "\n";
-			vertex_counter += 3;
+			obj_file << "f";
+			for(uint32_t j = 0; j < 3; j++)
+			{
+				int v = vertex_counter + model->m_indices[i + j];
+				obj_file << " " << v << "/" << v << "/" << v;
+			}
+			obj_file << "\n";
 		}
+		vertex_counter += mesh.m_number_of_vertices;
 	}
 }
 
@@ -478,6 +669,63 @@ void freeModel(Model* model)
 		delete model;
 }
 
+///////////////////////////////////////////////////////////////////////
+// A material as laid out in the std140 MaterialBlock uniform block
+///////////////////////////////////////////////////////////////////////
+struct MaterialBlock
+{
+	glm::vec3 color;
+	float metalness;
+	glm::vec3 emission;
+	float fresnel;
+	float shininess;
+	int32_t has_color_texture;
+	int32_t has_emission_texture;
+};
+
+// The uniform buffer binding point used for the MaterialBlock
+static const GLuint material_block_binding = 3;
+// The size of the block in std140, which rounds it up to a multiple of a
+// vec4. Binding a smaller range would leave shader reads undefined.
+static const GLsizeiptr material_block_size = (sizeof(MaterialBlock) + 15) / 16 * 16;
+
+void updateMaterialBuffer(Model* model)
+{
+	if(model->m_materials.empty())
+	{
+		return;
+	}
+	// Each material must start at a multiple of the offset alignment to
+	// be usable with glBindBufferRange
+	GLint alignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	alignment = std::max(alignment, 1);
+	model->m_material_stride = uint32_t((material_block_size + alignment - 1) / alignment * alignment);
+
+	std::vector<uint8_t> data(model->m_materials.size() * model->m_material_stride, 0);
+	for(size_t i = 0; i < model->m_materials.size(); i++)
+	{
+		const Material& material = model->m_materials[i];
+		MaterialBlock block;
+		block.color = material.m_color;
+		block.metalness = material.m_metalness;
+		block.emission = material.m_emission;
+		block.fresnel = material.m_fresnel;
+		block.shininess = material.m_shininess;
+		block.has_color_texture = material.m_color_texture.valid ? 1 : 0;
+		block.has_emission_texture = material.m_emission_texture.valid ? 1 : 0;
+		memcpy(&data[i * model->m_material_stride], &block, sizeof(MaterialBlock));
+	}
+
+	if(model->m_materials_ubo == 0)
+	{
+		glGenBuffers(1, &model->m_materials_ubo);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, model->m_materials_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Loop through all Meshes in the Model and render them
 ///////////////////////////////////////////////////////////////////////
@@ -486,6 +734,18 @@ void render(const Model* model, const bool submitMaterials)
 	GLint current_program = 0;
 	glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
 
+	// Use the material buffer if the shader has a MaterialBlock
+	bool use_material_block = false;
+	if(submitMaterials && model->m_materials_ubo != 0)
+	{
+		GLuint block_index = getUniformBlockIndex(current_program, "MaterialBlock");
+		if(block_index != GL_INVALID_INDEX)
+		{
+			glUniformBlockBinding(current_program, block_index, material_block_binding);
+			use_material_block = true;
+		}
+	}
+
 	glBindVertexArray(model->m_vaob);
 	for(auto& mesh : model->m_meshes)
 	{
@@ -528,14 +788,22 @@ void render(const Model* model, const bool submitMaterials)
 			}
 			glActiveTexture(GL_TEXTURE0);
 
-			setUniformSlow(current_program, "has_color_texture", has_color_texture);
-			setUniformSlow(current_program, "has_emission_texture", has_emission_texture);
-
-			setUniformSlow(current_program, "material_color", material.m_color);
-			setUniformSlow(current_program, "material_metalness", material.m_metalness);
-			setUniformSlow(current_program, "material_fresnel", material.m_fresnel);
-			setUniformSlow(current_program, "material_shininess", material.m_shininess);
-			setUniformSlow(current_program, "material_emission", material.m_emission);
+			if(use_material_block)
+			{
+				glBindBufferRange(GL_UNIFORM_BUFFER, material_block_binding, model->m_materials_ubo,
+				                  mesh.m_material_idx * model->m_material_stride, material_block_size);
+			}
+			else
+			{
+				setUniformSlow(current_program, "has_color_texture", has_color_texture);
+				setUniformSlow(current_program, "has_emission_texture", has_emission_texture);
+
+				setUniformSlow(current_program, "material_color", material.m_color);
+				setUniformSlow(current_program, "material_metalness", material.m_metalness);
+				setUniformSlow(current_program, "material_fresnel", material.m_fresnel);
+				setUniformSlow(current_program, "material_shininess", material.m_shininess);
+				setUniformSlow(current_program, "material_emission", material.m_emission);
+			}
 
 			// Actually unused in the labs
 			/*
@@ -544,7 +812,10 @@ void render(const Model* model, const bool submitMaterials)
 			setUniformSlow( current_program, "has_shininess_texture", has_shininess_texture );
 			*/
 		}
-		glDrawArrays(GL_TRIANGLES, mesh.m_start_index, (GLsizei)mesh.m_number_of_vertices);
+		const size_t index_size =
+		    model->m_index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+		glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)mesh.m_number_of_indices, model->m_index_type,
+		                         (void*)(mesh.m_start_index * index_size), (GLint)mesh.m_base_vertex);
 	}
 	glBindVertexArray(0);
 }
@@ -2,7 +2,6 @@
 #include <string>
 #include <vector>
 #include <memory>
-#include <memory>
 #include <glm/glm.hpp>
 
 namespace labhelper
@@ -18,7 +17,10 @@ struct Texture
 	uint8_t* data;
 	uint8_t n_components = 4;
 
-	bool load(const std::string& directory, const std::string& filename, int nof_components);
+	bool load(const std::string& directory,
+	          const std::string& filename,
+	          int nof_components,
+	          bool upload_to_gpu = true);
 	glm::vec4 sample(glm::vec2 uv) const;
 	void free();
 };
@@ -47,12 +49,22 @@ struct Material
 	Texture m_emission_texture;
 };
 
+///////////////////////////////////////////////////////////////////////////
+// A Mesh is an indexed triangle list. Its (welded) vertices are stored
+// contiguously in the Model's vertex streams, starting at m_base_vertex,
+// and its indices are relative to m_base_vertex so that they fit in 16
+// bits whenever the mesh has at most 65536 vertices.
+///////////////////////////////////////////////////////////////////////////
 struct Mesh
 {
 	std::string m_name;
 	uint32_t m_material_idx;
-	// Where this Mesh's vertices start
+	// Where this Mesh's indices start in the Model's index buffer
 	uint32_t m_start_index;
+	// Number of indices (three per triangle)
+	uint32_t m_number_of_indices;
+	// Where this Mesh's vertices start, and how many there are
+	uint32_t m_base_vertex;
 	uint32_t m_number_of_vertices;
 };
 
@@ -68,21 +80,62 @@ public:
 	std::vector<Material> m_materials;
 	// A model will contain one or more "Meshes"
 	std::vector<Mesh> m_meshes;
-	// Buffers on CPU
+	// Buffers on CPU, with m_number_of_vertices elements each. The
+	// positions have one more, for padding, so that the last position can
+	// be read with a 16 byte load (as Embree does when it shares them).
+	uint32_t m_number_of_vertices = 0;
 	std::vector<glm::vec3> m_positions;
 	std::vector<glm::vec3> m_normals;
 	std::vector<glm::vec2> m_texture_coordinates;
-	// Buffers on GPU
-	uint32_t m_positions_bo;
-	uint32_t m_normals_bo;
-	uint32_t m_texture_coordinates_bo;
+	std::vector<uint32_t> m_indices;
+	// Buffers on GPU (0 if the model was loaded without a GL context)
+	uint32_t m_positions_bo = 0;
+	uint32_t m_normals_bo = 0;
+	uint32_t m_texture_coordinates_bo = 0;
+	uint32_t m_indices_bo = 0;
+	// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, depending on the largest mesh
+	uint32_t m_index_type = 0;
+	// Uniform buffer with all materials (see updateMaterialBuffer), each
+	// one m_material_stride bytes after the previous one
+	uint32_t m_materials_ubo = 0;
+	uint32_t m_material_stride = 0;
 	// Vertex Array Object
-	uint32_t m_vaob;
+	uint32_t m_vaob = 0;
 };
 
-Model* loadModelFromOBJ(std::string filename);
+///////////////////////////////////////////////////////////////////////////
+/// Load a model from an OBJ file. With upload_to_gpu = false, no GL calls
+/// are made and only the CPU side buffers are filled in, which allows
+/// loading models without a GL context (e.g. for headless rendering).
+///////////////////////////////////////////////////////////////////////////
+Model* loadModelFromOBJ(std::string filename, bool upload_to_gpu = true);
 void saveModelToOBJ(Model* model, std::string filename);
 void saveModelMaterialsToMTL(Model* model, std::string filename);
 void freeModel(Model* model);
+
+///////////////////////////////////////////////////////////////////////////
+/// Render all meshes of a model with the current shader program. If the
+/// program declares the uniform block
+///     layout(std140) uniform MaterialBlock
+///     {
+///         vec3 material_color;
+///         float material_metalness;
+///         vec3 material_emission;
+///         float material_fresnel;
+///         float material_shininess;
+///         int has_color_texture;
+///         int has_emission_texture;
+///     };
+/// each mesh's material is selected from the model's material buffer with
+/// a single glBindBufferRange. Otherwise the material is submitted as
+/// individual uniforms with the same names.
+///////////////////////////////////////////////////////////////////////////
 void render(const Model* model, const bool submitMaterials = true);
+
+///////////////////////////////////////////////////////////////////////////
+/// (Re)upload the materials of a model to its uniform buffer. Must be
+/// called after changing the materials of an uploaded model, for the
+/// changes to show up in shaders that use the MaterialBlock.
+///////////////////////////////////////////////////////////////////////////
+void updateMaterialBuffer(Model* model);
 } // namespace labhelper
\ No newline at end of file
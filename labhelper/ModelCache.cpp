@@ -0,0 +1,462 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ModelCache.h"
+#include "labhelper.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+namespace labhelper
+{
+namespace
+{
+	// Bump whenever the layout below changes
+	const uint32_t model_cache_version = 3;
+	const char model_cache_magic[8] = { 'L', 'H', 'M', 'O', 'D', 'E', 'L', '\0' };
+
+	///////////////////////////////////////////////////////////////////////
+	// The cache starts with this header, followed by the payload:
+	//   dependencies: name (relative to the OBJ file's directory), mtime
+	//                 and size of each material library and texture
+	//   positions, normals, texture coordinates (number_of_vertices each)
+	//   indices  : number_of_indices
+	//   meshes   : name, material index, start index, number of indices,
+	//              base vertex, number of vertices
+	//   materials: name, parameters and texture file names
+	///////////////////////////////////////////////////////////////////////
+	struct CacheHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t number_of_materials;
+		uint32_t number_of_meshes;
+		uint32_t number_of_indices;
+		uint64_t number_of_vertices;
+		int64_t obj_mtime;
+		uint64_t obj_size;
+		uint64_t number_of_dependencies;
+		uint64_t payload_size;
+		uint64_t checksum;
+	};
+
+	std::string cacheFilename(const std::string& obj_filename)
+	{
+		return file::change_extension(obj_filename, ".objcache");
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Modification time and size of a file, or false if it doesn't exist
+	///////////////////////////////////////////////////////////////////////
+	bool fileStatus(const std::string& filename, int64_t& mtime, uint64_t& size)
+	{
+		struct stat st;
+		if(stat(filename.c_str(), &st) != 0)
+		{
+			return false;
+		}
+		mtime = int64_t(st.st_mtime);
+		size = uint64_t(st.st_size);
+		return true;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// A file other than the OBJ that the model was built from. Files that
+	// don't exist have mtime and size 0, so that creating one of them
+	// (e.g. the first of several material libraries) invalidates the cache.
+	///////////////////////////////////////////////////////////////////////
+	struct Dependency
+	{
+		std::string name;
+		int64_t mtime;
+		uint64_t size;
+	};
+
+	void sourceStatus(const std::string& filename, int64_t& mtime, uint64_t& size)
+	{
+		if(!fileStatus(filename, mtime, size))
+		{
+			mtime = 0;
+			size = 0;
+		}
+	}
+
+	// 64-bit FNV-1a
+	uint64_t checksum(const uint8_t* data, size_t size)
+	{
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for(size_t i = 0; i < size; i++)
+		{
+			hash ^= data[i];
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// A read-only memory mapped file
+	///////////////////////////////////////////////////////////////////////
+	class MappedFile
+	{
+	public:
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+
+		bool open(const std::string& filename)
+		{
+#ifdef _WIN32
+			file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			                   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if(file == INVALID_HANDLE_VALUE)
+				return false;
+			LARGE_INTEGER file_size;
+			if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+				return false;
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if(mapping == nullptr)
+				return false;
+			data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			size = size_t(file_size.QuadPart);
+#else
+			fd = ::open(filename.c_str(), O_RDONLY);
+			if(fd < 0)
+				return false;
+			struct stat st;
+			if(fstat(fd, &st) != 0 || st.st_size == 0)
+				return false;
+			void* ptr = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if(ptr == MAP_FAILED)
+				return false;
+			data = static_cast<const uint8_t*>(ptr);
+			size = size_t(st.st_size);
+#endif
+			return data != nullptr;
+		}
+
+		~MappedFile()
+		{
+#ifdef _WIN32
+			if(data)
+				UnmapViewOfFile(data);
+			if(mapping)
+				CloseHandle(mapping);
+			if(file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+#else
+			if(data)
+				munmap(const_cast<uint8_t*>(data), size);
+			if(fd >= 0)
+				close(fd);
+#endif
+		}
+
+	private:
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#else
+		int fd = -1;
+#endif
+	};
+
+	///////////////////////////////////////////////////////////////////////
+	// Bounds checked reading from the mapped payload
+	///////////////////////////////////////////////////////////////////////
+	struct CacheReader
+	{
+		const uint8_t* ptr;
+		const uint8_t* end;
+
+		bool read(void* dst, size_t bytes)
+		{
+			if(size_t(end - ptr) < bytes)
+				return false;
+			memcpy(dst, ptr, bytes);
+			ptr += bytes;
+			return true;
+		}
+		template<typename T>
+		bool read(T& value)
+		{
+			return read(&value, sizeof(T));
+		}
+		bool read(std::string& str)
+		{
+			uint32_t length;
+			if(!read(length) || size_t(end - ptr) < length)
+				return false;
+			str.assign(reinterpret_cast<const char*>(ptr), length);
+			ptr += length;
+			return true;
+		}
+	};
+
+	///////////////////////////////////////////////////////////////////////
+	// Serialization of the payload
+	///////////////////////////////////////////////////////////////////////
+	struct CacheWriter
+	{
+		std::string buffer;
+
+		void write(const void* src, size_t bytes)
+		{
+			buffer.append(static_cast<const char*>(src), bytes);
+		}
+		template<typename T>
+		void write(const T& value)
+		{
+			write(&value, sizeof(T));
+		}
+		void write(const std::string& str)
+		{
+			write(uint32_t(str.size()));
+			write(str.data(), str.size());
+		}
+		void write(const Texture& texture)
+		{
+			write(texture.valid ? texture.filename : std::string());
+		}
+	};
+} // namespace
+
+Model* loadModelCache(const std::string& obj_filename, bool upload_to_gpu)
+{
+	MappedFile cache;
+	if(!cache.open(cacheFilename(obj_filename)) || cache.size < sizeof(CacheHeader))
+	{
+		return nullptr;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Check that the cache is valid and was built from the current
+	// version of the OBJ file, its material libraries and textures
+	///////////////////////////////////////////////////////////////////////
+	CacheHeader header;
+	memcpy(&header, cache.data, sizeof(CacheHeader));
+	int64_t obj_mtime;
+	uint64_t obj_size;
+	sourceStatus(obj_filename, obj_mtime, obj_size);
+	if(memcmp(header.magic, model_cache_magic, sizeof(model_cache_magic)) != 0
+	   || header.version != model_cache_version || header.obj_mtime != obj_mtime
+	   || header.obj_size != obj_size || header.payload_size != cache.size - sizeof(CacheHeader))
+	{
+		return nullptr;
+	}
+	const uint8_t* payload = cache.data + sizeof(CacheHeader);
+	if(checksum(payload, size_t(header.payload_size)) != header.checksum)
+	{
+		std::cout << "(corrupt cache, reparsing)..." << std::flush;
+		return nullptr;
+	}
+	CacheReader reader = { payload, payload + header.payload_size };
+	const std::string directory = file::parent_path(obj_filename);
+	for(uint64_t i = 0; i < header.number_of_dependencies; i++)
+	{
+		Dependency recorded, current;
+		if(!reader.read(recorded.name) || !reader.read(recorded.mtime) || !reader.read(recorded.size))
+		{
+			std::cout << "(invalid cache, reparsing)..." << std::flush;
+			return nullptr;
+		}
+		sourceStatus(directory + recorded.name, current.mtime, current.size);
+		if(recorded.mtime != current.mtime || recorded.size != current.size)
+		{
+			return nullptr;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Copy the vertex and index streams straight out of the mapping
+	///////////////////////////////////////////////////////////////////////
+	Model* model = new Model;
+	model->m_name = file::file_stem(obj_filename);
+	model->m_filename = obj_filename;
+	const size_t n = size_t(header.number_of_vertices);
+	model->m_number_of_vertices = uint32_t(n);
+	// With the padding element that Model keeps after the positions
+	model->m_positions.resize(n + 1);
+	model->m_normals.resize(n);
+	model->m_texture_coordinates.resize(n);
+	model->m_indices.resize(header.number_of_indices);
+	bool ok = reader.read(model->m_positions.data(), n * sizeof(glm::vec3))
+	          && reader.read(model->m_normals.data(), n * sizeof(glm::vec3))
+	          && reader.read(model->m_texture_coordinates.data(), n * sizeof(glm::vec2))
+	          && reader.read(model->m_indices.data(), model->m_indices.size() * sizeof(uint32_t));
+
+	model->m_meshes.resize(header.number_of_meshes);
+	for(auto& mesh : model->m_meshes)
+	{
+		ok = ok && reader.read(mesh.m_name) && reader.read(mesh.m_material_idx)
+		     && reader.read(mesh.m_start_index) && reader.read(mesh.m_number_of_indices)
+		     && reader.read(mesh.m_base_vertex) && reader.read(mesh.m_number_of_vertices);
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Materials. Textures are stored by name and loaded from disk.
+	///////////////////////////////////////////////////////////////////////
+	model->m_materials.resize(header.number_of_materials);
+	for(auto& material : model->m_materials)
+	{
+		std::string color_texture, metalness_texture, fresnel_texture, shininess_texture, emission_texture;
+		ok = ok && reader.read(material.m_name) && reader.read(material.m_color)
+		     && reader.read(material.m_shininess) && reader.read(material.m_metalness)
+		     && reader.read(material.m_fresnel) && reader.read(material.m_emission)
+		     && reader.read(material.m_transparency) && reader.read(material.m_ior)
+		     && reader.read(color_texture) && reader.read(metalness_texture) && reader.read(fresnel_texture)
+		     && reader.read(shininess_texture) && reader.read(emission_texture);
+		if(!ok)
+		{
+			break;
+		}
+		if(!color_texture.empty())
+			material.m_color_texture.load(directory, color_texture, 4, upload_to_gpu);
+		if(!metalness_texture.empty())
+			material.m_metalness_texture.load(directory, metalness_texture, 1, upload_to_gpu);
+		if(!fresnel_texture.empty())
+			material.m_fresnel_texture.load(directory, fresnel_texture, 1, upload_to_gpu);
+		if(!shininess_texture.empty())
+			material.m_shininess_texture.load(directory, shininess_texture, 1, upload_to_gpu);
+		if(!emission_texture.empty())
+			material.m_emission_texture.load(directory, emission_texture, 4, upload_to_gpu);
+	}
+
+	for(const auto& mesh : model->m_meshes)
+	{
+		ok = ok && mesh.m_material_idx < model->m_materials.size()
+		     && uint64_t(mesh.m_start_index) + mesh.m_number_of_indices <= model->m_indices.size()
+		     && uint64_t(mesh.m_base_vertex) + mesh.m_number_of_vertices <= n;
+		for(uint32_t i = 0; ok && i < mesh.m_number_of_indices; i++)
+		{
+			ok = model->m_indices[mesh.m_start_index + i] < mesh.m_number_of_vertices;
+		}
+	}
+	if(!ok)
+	{
+		std::cout << "(invalid cache, reparsing)..." << std::flush;
+		delete model;
+		return nullptr;
+	}
+	std::cout << "(from cache)..." << std::flush;
+	return model;
+}
+
+void saveModelCache(const Model* model,
+                    const std::string& obj_filename,
+                    const std::vector<std::string>& material_libraries)
+{
+	///////////////////////////////////////////////////////////////////////
+	// The material libraries and textures, each listed once
+	///////////////////////////////////////////////////////////////////////
+	std::vector<std::string> names = material_libraries;
+	for(const auto& material : model->m_materials)
+	{
+		for(const Texture* texture : { &material.m_color_texture, &material.m_metalness_texture,
+		                               &material.m_fresnel_texture, &material.m_shininess_texture,
+		                               &material.m_emission_texture })
+		{
+			if(texture->valid)
+			{
+				names.push_back(texture->filename);
+			}
+		}
+	}
+	std::sort(names.begin(), names.end());
+	names.erase(std::unique(names.begin(), names.end()), names.end());
+
+	CacheWriter writer;
+	const std::string directory = file::parent_path(obj_filename);
+	for(const auto& name : names)
+	{
+		Dependency dependency = { name, 0, 0 };
+		sourceStatus(directory + name, dependency.mtime, dependency.size);
+		writer.write(dependency.name);
+		writer.write(dependency.mtime);
+		writer.write(dependency.size);
+	}
+	const size_t n = model->m_number_of_vertices;
+	writer.write(model->m_positions.data(), n * sizeof(glm::vec3));
+	writer.write(model->m_normals.data(), n * sizeof(glm::vec3));
+	writer.write(model->m_texture_coordinates.data(), n * sizeof(glm::vec2));
+	writer.write(model->m_indices.data(), model->m_indices.size() * sizeof(uint32_t));
+	for(const auto& mesh : model->m_meshes)
+	{
+		writer.write(mesh.m_name);
+		writer.write(mesh.m_material_idx);
+		writer.write(mesh.m_start_index);
+		writer.write(mesh.m_number_of_indices);
+		writer.write(mesh.m_base_vertex);
+		writer.write(mesh.m_number_of_vertices);
+	}
+	for(const auto& material : model->m_materials)
+	{
+		writer.write(material.m_name);
+		writer.write(material.m_color);
+		writer.write(material.m_shininess);
+		writer.write(material.m_metalness);
+		writer.write(material.m_fresnel);
+		writer.write(material.m_emission);
+		writer.write(material.m_transparency);
+		writer.write(material.m_ior);
+		writer.write(material.m_color_texture);
+		writer.write(material.m_metalness_texture);
+		writer.write(material.m_fresnel_texture);
+		writer.write(material.m_shininess_texture);
+		writer.write(material.m_emission_texture);
+	}
+
+	CacheHeader header = {};
+	memcpy(header.magic, model_cache_magic, sizeof(model_cache_magic));
+	header.version = model_cache_version;
+	header.number_of_materials = uint32_t(model->m_materials.size());
+	header.number_of_meshes = uint32_t(model->m_meshes.size());
+	header.number_of_indices = uint32_t(model->m_indices.size());
+	header.number_of_vertices = n;
+	header.number_of_dependencies = names.size();
+	sourceStatus(obj_filename, header.obj_mtime, header.obj_size);
+	header.payload_size = writer.buffer.size();
+	header.checksum = checksum(reinterpret_cast<const uint8_t*>(writer.buffer.data()), writer.buffer.size());
+
+	///////////////////////////////////////////////////////////////////////
+	// Write to a temporary file first, so that an interrupted write never
+	// leaves a cache that looks valid.
+	///////////////////////////////////////////////////////////////////////
+	const std::string filename = cacheFilename(obj_filename);
+	const std::string temp_filename = filename + ".tmp";
+	{
+		std::ofstream cache_file(temp_filename, std::ios::binary | std::ios::trunc);
+		if(!cache_file.is_open())
+		{
+			std::cout << "(could not write cache " << filename << ")..." << std::flush;
+			return;
+		}
+		cache_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		cache_file.write(writer.buffer.data(), writer.buffer.size());
+		if(!cache_file.good())
+		{
+			cache_file.close();
+			std::remove(temp_filename.c_str());
+			std::cout << "(could not write cache " << filename << ")..." << std::flush;
+			return;
+		}
+	}
+	std::remove(filename.c_str());
+	if(std::rename(temp_filename.c_str(), filename.c_str()) != 0)
+	{
+		std::remove(temp_filename.c_str());
+		std::cout << "(could not write cache " << filename << ")..." << std::flush;
+	}
+}
+} // namespace labhelper
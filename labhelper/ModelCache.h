@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Model.h"
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// Binary cache of models loaded from OBJ files, stored next to the OBJ
+/// file as <name>.objcache. It holds the vertex streams, meshes and
+/// materials of the model and is only used while the modification times
+/// and sizes of the OBJ file, the material libraries it names and the
+/// textures they use match the ones recorded in the cache, and its
+/// checksum is intact.
+///////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////
+/// Memory map the cache for `obj_filename` and build a Model from it.
+/// Returns nullptr if there is no valid, up to date cache.
+///////////////////////////////////////////////////////////////////////////
+Model* loadModelCache(const std::string& obj_filename, bool upload_to_gpu);
+
+///////////////////////////////////////////////////////////////////////////
+/// Write the cache for a model that was just parsed from `obj_filename`,
+/// which looked for `material_libraries` (see loadObjParallel()).
+/// Failing to write the cache is reported but not fatal.
+///////////////////////////////////////////////////////////////////////////
+void saveModelCache(const Model* model,
+                    const std::string& obj_filename,
+                    const std::vector<std::string>& material_libraries);
+} // namespace labhelper
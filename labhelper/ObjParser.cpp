@@ -0,0 +1,643 @@
+#include "ObjParser.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+// A read-only mapping of a whole file
+///////////////////////////////////////////////////////////////////////////
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& filename)
+	{
+#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		                   FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if(file == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+		LARGE_INTEGER file_size;
+		GetFileSizeEx(file, &file_size);
+		size = size_t(file_size.QuadPart);
+		opened = true;
+		if(size == 0)
+		{
+			return;
+		}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if(mapping != nullptr)
+		{
+			data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+		opened = data != nullptr;
+#else
+		fd = open(filename.c_str(), O_RDONLY);
+		if(fd < 0)
+		{
+			return;
+		}
+		struct stat file_stat;
+		if(fstat(fd, &file_stat) != 0)
+		{
+			return;
+		}
+		size = size_t(file_stat.st_size);
+		opened = true;
+		if(size == 0)
+		{
+			return;
+		}
+		void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(mapped == MAP_FAILED)
+		{
+			opened = false;
+			return;
+		}
+		madvise(mapped, size, MADV_SEQUENTIAL);
+		data = (const char*)mapped;
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if(data != nullptr)
+			UnmapViewOfFile(data);
+		if(mapping != nullptr)
+			CloseHandle(mapping);
+		if(file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if(data != nullptr)
+			munmap((void*)data, size);
+		if(fd >= 0)
+			close(fd);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data = nullptr;
+	size_t size = 0;
+	bool opened = false;
+
+private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Token parsing. All parsers stop at `end`, the end of the line.
+///////////////////////////////////////////////////////////////////////////
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static inline bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline const char* skipSpace(const char* s, const char* end)
+{
+	while(s < end && isSpace(*s))
+		s++;
+	return s;
+}
+
+// Skip to the next space (or '\r', like tinyobj)
+static inline const char* skipToken(const char* s, const char* end)
+{
+	while(s < end && !isSpace(*s) && *s != '\r')
+		s++;
+	return s;
+}
+
+static inline std::string parseName(const char* s, const char* end)
+{
+	s = skipSpace(s, end);
+	return std::string(s, skipToken(s, end));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Parse a decimal number. Up to 18 significant digits are accumulated in
+// an integer, which is then scaled by a power of ten in double precision
+// and rounded to float. Returns false (leaving `s` unchanged) if there is
+// no number.
+///////////////////////////////////////////////////////////////////////////
+static inline bool parseFloat(const char*& s, const char* end, float* value)
+{
+	static const double powers_of_ten[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+		                                    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+		                                    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const char* p = s;
+	bool negative = false;
+	if(p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	bool any_digits = false;
+	for(; p < end && isDigit(*p); p++)
+	{
+		any_digits = true;
+		if(mantissa < 100000000000000000ull)
+			mantissa = mantissa * 10 + uint64_t(*p - '0');
+		else
+			exponent++;
+	}
+	if(p < end && *p == '.')
+	{
+		for(p++; p < end && isDigit(*p); p++)
+		{
+			any_digits = true;
+			if(mantissa < 100000000000000000ull)
+			{
+				mantissa = mantissa * 10 + uint64_t(*p - '0');
+				exponent--;
+			}
+		}
+	}
+	if(!any_digits)
+	{
+		return false;
+	}
+	if(p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* q = p + 1;
+		bool negative_exponent = false;
+		if(q < end && (*q == '-' || *q == '+'))
+		{
+			negative_exponent = *q == '-';
+			q++;
+		}
+		if(q < end && isDigit(*q))
+		{
+			int e = 0;
+			for(; q < end && isDigit(*q); q++)
+			{
+				e = std::min(e * 10 + (*q - '0'), 100000);
+			}
+			exponent += negative_exponent ? -e : e;
+			p = q;
+		}
+	}
+	double result = double(mantissa);
+	if(mantissa != 0)
+	{
+		if(exponent > 0)
+			result *= exponent <= 22 ? powers_of_ten[exponent] : std::pow(10.0, exponent);
+		else if(exponent < 0)
+			result /= exponent >= -22 ? powers_of_ten[-exponent] : std::pow(10.0, -exponent);
+	}
+	*value = float(negative ? -result : result);
+	s = p;
+	return true;
+}
+
+// Parse `count` numbers into `values`, with 0 for missing or malformed ones
+// (as tinyobj's parseReal3() does)
+static inline void parseFloats(const char* s, const char* end, float* values, int count)
+{
+	for(int i = 0; i < count; i++)
+	{
+		s = skipSpace(s, end);
+		if(!parseFloat(s, end, &values[i]))
+		{
+			values[i] = 0.0f;
+		}
+		s = skipToken(s, end);
+	}
+}
+
+// Like atoi()
+static inline int parseInt(const char*& s, const char* end)
+{
+	bool negative = false;
+	if(s < end && (*s == '-' || *s == '+'))
+	{
+		negative = *s == '-';
+		s++;
+	}
+	int value = 0;
+	for(; s < end && isDigit(*s); s++)
+	{
+		value = value * 10 + (*s - '0');
+	}
+	return negative ? -value : value;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The result of parsing one chunk of the file. Everything that depends on
+// the lines before the chunk is resolved when the chunks are merged:
+// commands are replayed in order, and indices that are relative (negative
+// in the file) are only resolved within the chunk.
+///////////////////////////////////////////////////////////////////////////
+struct ObjCommand
+{
+	enum Type
+	{
+		USEMTL,
+		GROUP,
+		MTLLIB,
+	};
+	Type type;
+	// The number of triangles in the chunk before the command
+	size_t triangle;
+	// The material or group name, or the rest of the line for mtllib
+	std::string value;
+};
+
+struct ObjChunk
+{
+	std::vector<float> vertices, normals, texcoords;
+	// Three corners per triangle
+	std::vector<tinyobj::index_t> indices;
+	// Positions in `indices` of corners with relative vertex, normal and
+	// texcoord indices
+	std::vector<size_t> relative_vertices, relative_normals, relative_texcoords;
+	std::vector<ObjCommand> commands;
+};
+
+// One corner of a face, and which of its indices are relative
+struct ObjCorner
+{
+	tinyobj::index_t index;
+	bool relative_vertex, relative_normal, relative_texcoord;
+};
+
+// As tinyobj's fixIndex(), but relative indices are resolved against the
+// counts of the chunk
+static inline int fixIndex(int index, int chunk_count, bool* relative)
+{
+	*relative = index < 0;
+	if(index > 0)
+		return index - 1;
+	if(index == 0)
+		return 0;
+	return chunk_count + index;
+}
+
+static void parseFace(const char* s, const char* end, ObjChunk& chunk, std::vector<ObjCorner>& corners)
+{
+	const int vertex_count = int(chunk.vertices.size() / 3);
+	const int normal_count = int(chunk.normals.size() / 3);
+	const int texcoord_count = int(chunk.texcoords.size() / 2);
+	corners.clear();
+	s = skipSpace(s, end);
+	while(s < end && *s != '\r')
+	{
+		// v, v/vt, v//vn or v/vt/vn
+		ObjCorner corner = { { -1, -1, -1 }, false, false, false };
+		corner.index.vertex_index = fixIndex(parseInt(s, end), vertex_count, &corner.relative_vertex);
+		s = std::find_if(s, end, [](char c) { return c == '/' || isSpace(c) || c == '\r'; });
+		if(s < end && *s == '/')
+		{
+			s++;
+			if(s < end && *s == '/')
+			{
+				s++;
+				corner.index.normal_index = fixIndex(parseInt(s, end), normal_count, &corner.relative_normal);
+			}
+			else
+			{
+				corner.index.texcoord_index =
+				    fixIndex(parseInt(s, end), texcoord_count, &corner.relative_texcoord);
+				s = std::find_if(s, end, [](char c) { return c == '/' || isSpace(c) || c == '\r'; });
+				if(s < end && *s == '/')
+				{
+					s++;
+					corner.index.normal_index =
+					    fixIndex(parseInt(s, end), normal_count, &corner.relative_normal);
+				}
+			}
+			s = std::find_if(s, end, [](char c) { return c == '/' || isSpace(c) || c == '\r'; });
+		}
+		corners.push_back(corner);
+		while(s < end && (isSpace(*s) || *s == '\r'))
+			s++;
+	}
+	// Triangulate as a fan around the first corner
+	for(size_t k = 2; k < corners.size(); k++)
+	{
+		const ObjCorner* triangle[3] = { &corners[0], &corners[k - 1], &corners[k] };
+		for(const ObjCorner* corner : triangle)
+		{
+			if(corner->relative_vertex)
+				chunk.relative_vertices.push_back(chunk.indices.size());
+			if(corner->relative_normal)
+				chunk.relative_normals.push_back(chunk.indices.size());
+			if(corner->relative_texcoord)
+				chunk.relative_texcoords.push_back(chunk.indices.size());
+			chunk.indices.push_back(corner->index);
+		}
+	}
+}
+
+static bool startsWithCommand(const char* s, const char* end, const char* command)
+{
+	const size_t length = strlen(command);
+	return size_t(end - s) > length && strncmp(s, command, length) == 0 && isSpace(s[length]);
+}
+
+static void parseChunk(const char* begin, const char* end, ObjChunk& chunk)
+{
+	std::vector<ObjCorner> corners;
+	for(const char* line = begin; line < end;)
+	{
+		const char* line_end = (const char*)memchr(line, '\n', end - line);
+		if(line_end == nullptr)
+		{
+			line_end = end;
+		}
+		const char* s = skipSpace(line, line_end);
+		const char* e = line_end;
+		if(e > s && e[-1] == '\r')
+		{
+			e--;
+		}
+		line = line_end + 1;
+		if(s == e || *s == '#')
+		{
+			continue;
+		}
+
+		if(s[0] == 'v' && e - s > 1 && isSpace(s[1]))
+		{
+			float v[3] = { 0.0f, 0.0f, 0.0f };
+			parseFloats(s + 2, e, v, 3);
+			chunk.vertices.insert(chunk.vertices.end(), v, v + 3);
+		}
+		else if(startsWithCommand(s, e, "vn"))
+		{
+			float vn[3] = { 0.0f, 0.0f, 0.0f };
+			parseFloats(s + 3, e, vn, 3);
+			chunk.normals.insert(chunk.normals.end(), vn, vn + 3);
+		}
+		else if(startsWithCommand(s, e, "vt"))
+		{
+			float vt[2] = { 0.0f, 0.0f };
+			parseFloats(s + 3, e, vt, 2);
+			chunk.texcoords.insert(chunk.texcoords.end(), vt, vt + 2);
+		}
+		else if(startsWithCommand(s, e, "f"))
+		{
+			parseFace(s + 2, e, chunk, corners);
+		}
+		else if(startsWithCommand(s, e, "usemtl"))
+		{
+			chunk.commands.push_back({ ObjCommand::USEMTL, chunk.indices.size() / 3, parseName(s + 7, e) });
+		}
+		else if(startsWithCommand(s, e, "mtllib"))
+		{
+			chunk.commands.push_back({ ObjCommand::MTLLIB, chunk.indices.size() / 3, std::string(s + 7, e) });
+		}
+		else if(startsWithCommand(s, e, "g") || startsWithCommand(s, e, "o"))
+		{
+			chunk.commands.push_back({ ObjCommand::GROUP, chunk.indices.size() / 3, parseName(s + 2, e) });
+		}
+		// Other commands (s, l, p, t, ...) are ignored, as by tinyobj
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Load the first of the (space separated) material libraries that exists,
+// like tinyobj, and list the ones it looked for in `material_libraries`
+// (if not null)
+///////////////////////////////////////////////////////////////////////////
+static void loadMaterialLibrary(const std::string& filenames,
+                                const std::string& mtl_basedir,
+                                std::vector<tinyobj::material_t>* materials,
+                                std::map<std::string, int>* material_map,
+                                std::string* err,
+                                std::vector<std::string>* material_libraries)
+{
+	tinyobj::MaterialFileReader reader(mtl_basedir);
+	size_t start = 0;
+	bool any_filename = false;
+	while(start <= filenames.size())
+	{
+		size_t stop = filenames.find(' ', start);
+		if(stop == std::string::npos)
+		{
+			stop = filenames.size();
+		}
+		if(stop == start && stop == filenames.size())
+		{
+			break;
+		}
+		any_filename = true;
+		const std::string library = filenames.substr(start, stop - start);
+		if(material_libraries != nullptr)
+		{
+			material_libraries->push_back(library);
+		}
+		std::string err_mtl;
+		const bool ok = reader(library, materials, material_map, &err_mtl);
+		*err += err_mtl;
+		if(ok)
+		{
+			return;
+		}
+		start = stop + 1;
+	}
+	*err += any_filename ? "WARN: Failed to load material file(s). Use default material.\n" :
+	                       "WARN: Looks like empty filename for mtllib. Use default material. \n";
+}
+
+bool loadObjParallel(tinyobj::attrib_t* attrib,
+                     std::vector<tinyobj::shape_t>* shapes,
+                     std::vector<tinyobj::material_t>* materials,
+                     std::string* err,
+                     const std::string& filename,
+                     const std::string& mtl_basedir,
+                     std::vector<std::string>* material_libraries)
+{
+	attrib->vertices.clear();
+	attrib->normals.clear();
+	attrib->texcoords.clear();
+	shapes->clear();
+
+	MappedFile file(filename);
+	if(!file.opened)
+	{
+		*err += "Cannot open file [" + filename + "]\n";
+		return false;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Split the file into one chunk per thread (but not into chunks of
+	// less than a megabyte), at line boundaries, and parse them
+	///////////////////////////////////////////////////////////////////////
+	const size_t min_chunk_size = 1 << 20;
+	size_t chunk_count = std::max(1u, std::thread::hardware_concurrency());
+	chunk_count = std::max<size_t>(1, std::min(chunk_count, file.size / min_chunk_size));
+	std::vector<const char*> boundaries(chunk_count + 1, file.data + file.size);
+	boundaries[0] = file.data;
+	for(size_t i = 1; i < chunk_count; i++)
+	{
+		const char* nominal = std::max(file.data + file.size * i / chunk_count, boundaries[i - 1]);
+		const char* newline = (const char*)memchr(nominal, '\n', file.data + file.size - nominal);
+		boundaries[i] = newline != nullptr ? newline + 1 : file.data + file.size;
+	}
+	std::vector<ObjChunk> chunks(chunk_count);
+	{
+		std::vector<std::thread> threads;
+		for(size_t i = 1; i < chunk_count; i++)
+		{
+			threads.emplace_back(parseChunk, boundaries[i], boundaries[i + 1], std::ref(chunks[i]));
+		}
+		parseChunk(boundaries[0], boundaries[1], chunks[0]);
+		for(auto& thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Offset each chunk's relative indices by the counts before it, and
+	// copy its attributes into place
+	///////////////////////////////////////////////////////////////////////
+	std::vector<size_t> vertex_base(chunk_count + 1, 0), normal_base(chunk_count + 1, 0),
+	    texcoord_base(chunk_count + 1, 0), triangle_base(chunk_count + 1, 0);
+	for(size_t i = 0; i < chunk_count; i++)
+	{
+		vertex_base[i + 1] = vertex_base[i] + chunks[i].vertices.size();
+		normal_base[i + 1] = normal_base[i] + chunks[i].normals.size();
+		texcoord_base[i + 1] = texcoord_base[i] + chunks[i].texcoords.size();
+		triangle_base[i + 1] = triangle_base[i] + chunks[i].indices.size() / 3;
+	}
+	attrib->vertices.resize(vertex_base[chunk_count]);
+	attrib->normals.resize(normal_base[chunk_count]);
+	attrib->texcoords.resize(texcoord_base[chunk_count]);
+	auto finishChunk = [&](size_t i) {
+		ObjChunk& chunk = chunks[i];
+		for(size_t corner : chunk.relative_vertices)
+			chunk.indices[corner].vertex_index += int(vertex_base[i] / 3);
+		for(size_t corner : chunk.relative_normals)
+			chunk.indices[corner].normal_index += int(normal_base[i] / 3);
+		for(size_t corner : chunk.relative_texcoords)
+			chunk.indices[corner].texcoord_index += int(texcoord_base[i] / 2);
+		std::copy(chunk.vertices.begin(), chunk.vertices.end(), attrib->vertices.begin() + vertex_base[i]);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), attrib->normals.begin() + normal_base[i]);
+		std::copy(chunk.texcoords.begin(), chunk.texcoords.end(),
+		          attrib->texcoords.begin() + texcoord_base[i]);
+		std::vector<float>().swap(chunk.vertices);
+		std::vector<float>().swap(chunk.normals);
+		std::vector<float>().swap(chunk.texcoords);
+	};
+	{
+		std::vector<std::thread> threads;
+		for(size_t i = 1; i < chunk_count; i++)
+		{
+			threads.emplace_back(finishChunk, i);
+		}
+		finishChunk(0);
+		for(auto& thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Replay the commands in file order, with the same state machine as
+	// tinyobj::LoadObj(): usemtl and g/o end the current face group, which
+	// is then added to the shape with the current material, and g/o also
+	// start a new shape (dropping the current one if the group was empty).
+	///////////////////////////////////////////////////////////////////////
+	std::map<std::string, int> material_map;
+	int material = -1;
+	std::string name;
+	tinyobj::shape_t shape;
+	size_t group_begin = 0;
+	auto exportGroup = [&](size_t group_end) {
+		if(group_end == group_begin)
+		{
+			return false;
+		}
+		for(size_t i = 0; i < chunk_count; i++)
+		{
+			const size_t begin = std::max(group_begin, triangle_base[i]);
+			const size_t end = std::min(group_end, triangle_base[i + 1]);
+			if(begin >= end)
+			{
+				continue;
+			}
+			const auto& indices = chunks[i].indices;
+			shape.mesh.indices.insert(shape.mesh.indices.end(),
+			                          indices.begin() + (begin - triangle_base[i]) * 3,
+			                          indices.begin() + (end - triangle_base[i]) * 3);
+		}
+		const size_t triangles = group_end - group_begin;
+		shape.mesh.num_face_vertices.resize(shape.mesh.num_face_vertices.size() + triangles, 3);
+		shape.mesh.material_ids.resize(shape.mesh.material_ids.size() + triangles, material);
+		shape.name = name;
+		group_begin = group_end;
+		return true;
+	};
+	for(size_t i = 0; i < chunk_count; i++)
+	{
+		for(const ObjCommand& command : chunks[i].commands)
+		{
+			const size_t triangle = triangle_base[i] + command.triangle;
+			if(command.type == ObjCommand::USEMTL)
+			{
+				auto it = material_map.find(command.value);
+				const int new_material = it != material_map.end() ? it->second : -1;
+				if(new_material != material)
+				{
+					exportGroup(triangle);
+					group_begin = triangle;
+					material = new_material;
+				}
+			}
+			else if(command.type == ObjCommand::GROUP)
+			{
+				if(exportGroup(triangle))
+				{
+					shapes->push_back(std::move(shape));
+				}
+				shape = tinyobj::shape_t();
+				group_begin = triangle;
+				name = command.value;
+			}
+			else
+			{
+				loadMaterialLibrary(command.value, mtl_basedir, materials, &material_map, err,
+				                    material_libraries);
+			}
+		}
+	}
+	if(exportGroup(triangle_base[chunk_count]) || !shape.mesh.indices.empty())
+	{
+		shapes->push_back(std::move(shape));
+	}
+	return true;
+}
+} // namespace labhelper
@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <tiny_obj_loader.h>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// Parse an OBJ file into the same attributes, (triangulated) shapes and
+/// materials as tinyobj::LoadObj(), but faster: the file is memory mapped
+/// and split at line boundaries into chunks that are parsed on separate
+/// threads, with a locale independent number parser. The chunks are then
+/// merged in file order, so the result doesn't depend on the number of
+/// threads. Material libraries are read from `mtl_basedir`. Unlike
+/// tinyobj, numbers without a leading digit (".5") are accepted, and tags
+/// ('t' lines) are ignored.
+///
+/// Returns false if the file can't be read. `err` receives warnings. If
+/// `material_libraries` is given, it receives the names (relative to
+/// `mtl_basedir`) of the material library files that were looked for,
+/// whether they were found or not.
+///////////////////////////////////////////////////////////////////////////
+bool loadObjParallel(tinyobj::attrib_t* attrib,
+                     std::vector<tinyobj::shape_t>* shapes,
+                     std::vector<tinyobj::material_t>* materials,
+                     std::string* err,
+                     const std::string& filename,
+                     const std::string& mtl_basedir,
+                     std::vector<std::string>* material_libraries = nullptr);
+} // namespace labhelper
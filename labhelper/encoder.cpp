@@ -0,0 +1,114 @@
+#include "encoder.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stb_image_write.h>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+// Encoding competes with rendering for the CPU, so only a couple of
+// threads are used. The queue holds a few frames beyond those being
+// encoded.
+///////////////////////////////////////////////////////////////////////////
+const int encoder_thread_count = 2;
+const size_t max_queued_jobs = 4;
+
+struct EncoderPool
+{
+	std::mutex mutex;
+	// Signalled when a job is queued or stopping is set
+	std::condition_variable job_available;
+	// Signalled when a job is taken from the queue or finished
+	std::condition_variable job_done;
+	std::deque<std::function<void()>> jobs;
+	int running_jobs = 0;
+	bool stopping = false;
+	std::vector<std::thread> threads;
+
+	EncoderPool()
+	{
+		for(int i = 0; i < encoder_thread_count; i++)
+		{
+			threads.emplace_back([this]() { work(); });
+		}
+	}
+
+	// Runs at exit: let the threads empty the queue, then stop them
+	~EncoderPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		job_available.notify_all();
+		for(auto& thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	void work()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for(;;)
+		{
+			job_available.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if(jobs.empty())
+			{
+				return;
+			}
+			std::function<void()> job = std::move(jobs.front());
+			jobs.pop_front();
+			running_jobs++;
+			job_done.notify_all();
+			lock.unlock();
+			job();
+			lock.lock();
+			running_jobs--;
+			job_done.notify_all();
+		}
+	}
+};
+
+static EncoderPool& encoderPool()
+{
+	static EncoderPool pool;
+	return pool;
+}
+
+void queueEncodeJob(std::function<void()> job)
+{
+	EncoderPool& pool = encoderPool();
+	{
+		std::unique_lock<std::mutex> lock(pool.mutex);
+		pool.job_done.wait(lock, [&pool]() { return pool.jobs.size() < max_queued_jobs; });
+		pool.jobs.push_back(std::move(job));
+	}
+	pool.job_available.notify_one();
+}
+
+void writePngAsync(const std::string& filename, int width, int height, int channels, std::vector<uint8_t> pixels)
+{
+	// std::function must be copyable, so the pixels are shared rather
+	// than moved into the lambda
+	auto data = std::make_shared<std::vector<uint8_t>>(std::move(pixels));
+	queueEncodeJob([filename, width, height, channels, data]() {
+		if(!stbi_write_png(filename.c_str(), width, height, channels, data->data(), 0))
+		{
+			std::cout << "Failed to write " << filename << "\n";
+		}
+	});
+}
+
+void finishEncodeJobs()
+{
+	EncoderPool& pool = encoderPool();
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	pool.job_done.wait(lock, [&pool]() { return pool.jobs.empty() && pool.running_jobs == 0; });
+}
+} // namespace labhelper
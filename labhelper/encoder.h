@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// A few background threads that encode and write images, so that the
+/// render loop doesn't wait for PNG compression or the disk. Jobs go
+/// through a bounded queue: when it is full, queueEncodeJob() waits for
+/// room, so a producer that outpaces the encoders is slowed down instead
+/// of buffering frames without limit. Jobs still queued at exit are
+/// finished before the program ends.
+///////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////
+/// Run `job` on one of the encoder threads
+///////////////////////////////////////////////////////////////////////////
+void queueEncodeJob(std::function<void()> job);
+
+///////////////////////////////////////////////////////////////////////////
+/// Write 8 bit pixels (top row first) to a PNG file on an encoder thread.
+/// The pixels are moved into the job, not copied.
+///////////////////////////////////////////////////////////////////////////
+void writePngAsync(const std::string& filename, int width, int height, int channels, std::vector<uint8_t> pixels);
+
+///////////////////////////////////////////////////////////////////////////
+/// Wait until all queued jobs are done
+///////////////////////////////////////////////////////////////////////////
+void finishEncodeJobs();
+} // namespace labhelper
@@ -1,4 +1,5 @@
 #include "hdr.h"
+#include "tonemap.h"
 #include <iostream>
 #include <stb_image.h>
 #include <stb_image_write.h>
@@ -96,12 +97,13 @@ void saveHdrTexture(const std::string& filename, GLuint texture)
 		for(int c = 0; c < lwidth * n_channels; ++c)
 		{
 			std::swap(img[a + c], img[b + c]);
-
-			img_png[a + c] = uint8_t(255 * (img[a + c] / (1 + img[a + c])));
-			img_png[b + c] = uint8_t(255 * (img[b + c] / (1 + img[b + c])));
 		}
 	}
 
+	ToneMapSettings tone_map;
+	tone_map.tone_operator = TONEMAP_REINHARD;
+	toneMapImage(img.data(), lwidth, lheight, tone_map, img_png.data());
+
 
 	stbi_write_hdr((filename + ".hdr").c_str(), lwidth, lheight, 3, img.data());
 	stbi_write_png((filename + ".png").c_str(), lwidth, lheight, 3, img_png.data(), 0);
@@ -18,6 +18,7 @@
 #include <stb_image_write.h>
 
 #include "labhelper.h"
+#include "encoder.h"
 
 #include <cmath>
 #include <cstring>
@@ -27,6 +28,7 @@
 #include <iomanip>
 
 #include <vector>
+#include <unordered_map>
 #include <sstream>
 #include <iostream>
 #include <algorithm>
@@ -123,8 +125,14 @@ SDL_Window* init_window_SDL(std::string caption, int width, int height)
 	return window;
 }
 
+static void finishScreenshots(bool wait);
+
 void shutDown(SDL_Window* window)
 {
+	// Write out any screenshots still being read back or encoded
+	finishScreenshots(true);
+	finishEncodeJobs();
+
 	// If newframe is not ever run before shut down we crash
 	ImGui_ImplSdlGL3_NewFrame(window);
 
@@ -508,6 +516,16 @@ std::string GetShaderProgramInfoLog(GLuint obj)
 }
 
 
+///////////////////////////////////////////////////////////////////////////
+// Uniform locations and block indices of each shader program, by name
+///////////////////////////////////////////////////////////////////////////
+struct UniformCache
+{
+	std::unordered_map<std::string, GLint> locations;
+	std::unordered_map<std::string, GLuint> block_indices;
+};
+static std::unordered_map<GLuint, UniformCache> uniform_caches;
+
 GLuint loadShaderProgram(const std::string& vertexShader, const std::string& fragmentShader, bool allow_errors)
 {
 	GLuint vShader = glCreateShader(GL_VERTEX_SHADER);
@@ -576,6 +594,8 @@ GLuint loadShaderProgram(const std::string& vertexShader, const std::string& fra
 
 bool linkShaderProgram(GLuint shaderProgram, bool allow_errors)
 {
+	// Linking may move the uniforms around
+	uniform_caches.erase(shaderProgram);
 	glLinkProgram(shaderProgram);
 	GLint linkOk = 0;
 	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &linkOk);
@@ -639,36 +659,58 @@ GLuint createAddIndexBuffer(GLuint vertexArrayObject,
 }
 
 
+GLint getUniformLocation(GLuint shaderProgram, const char* name)
+{
+	auto& locations = uniform_caches[shaderProgram].locations;
+	auto it = locations.find(name);
+	if(it == locations.end())
+	{
+		it = locations.insert({ name, glGetUniformLocation(shaderProgram, name) }).first;
+	}
+	return it->second;
+}
+
+GLuint getUniformBlockIndex(GLuint shaderProgram, const char* name)
+{
+	auto& block_indices = uniform_caches[shaderProgram].block_indices;
+	auto it = block_indices.find(name);
+	if(it == block_indices.end())
+	{
+		it = block_indices.insert({ name, glGetUniformBlockIndex(shaderProgram, name) }).first;
+	}
+	return it->second;
+}
+
 void setUniformSlow(GLuint shaderProgram, const char* name, const glm::mat4& matrix)
 {
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, name), 1, false, &matrix[0].x);
+	glUniformMatrix4fv(getUniformLocation(shaderProgram, name), 1, false, &matrix[0].x);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const float value)
 {
-	glUniform1f(glGetUniformLocation(shaderProgram, name), value);
+	glUniform1f(getUniformLocation(shaderProgram, name), value);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const GLint value)
 {
-	int loc = glGetUniformLocation(shaderProgram, name);
+	int loc = getUniformLocation(shaderProgram, name);
 	glUniform1i(loc, value);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const GLuint value)
 {
-	int loc = glGetUniformLocation(shaderProgram, name);
+	int loc = getUniformLocation(shaderProgram, name);
 	glUniform1ui(loc, value);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const bool value)
 {
-	int loc = glGetUniformLocation(shaderProgram, name);
+	int loc = getUniformLocation(shaderProgram, name);
 	glUniform1i(loc, value ? 1 : 0);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const glm::vec3& value)
 {
-	glUniform3fv(glGetUniformLocation(shaderProgram, name), 1, &value.x);
+	glUniform3fv(getUniformLocation(shaderProgram, name), 1, &value.x);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const uint32_t nof_values, const glm::vec3* values)
 {
-	glUniform3fv(glGetUniformLocation(shaderProgram, name), nof_values, (float*)values);
+	glUniform3fv(getUniformLocation(shaderProgram, name), nof_values, (float*)values);
 }
 
 void debugDrawArrow(const glm::mat4& viewMat, const glm::mat4& projMat, glm::vec3 start, glm::vec3 point)
@@ -807,37 +849,121 @@ void debugDrawDisc()
 	glBindVertexArray(0);
 }
 
-void saveScreenshot()
+///////////////////////////////////////////////////////////////////////////
+/// Screenshots are read back into a pixel buffer object, with a fence
+/// after the read. Once the fence has passed, the pixels are copied out
+/// (flipping the rows) and handed to the encoder threads.
+///////////////////////////////////////////////////////////////////////////
+struct PendingScreenshot
 {
-	std::vector<uint8_t> img;
-
+	std::string filename;
+	int width, height;
+	GLuint pbo;
+	GLsync fence;
+};
+static std::vector<PendingScreenshot> pending_screenshots;
 
+void saveScreenshot()
+{
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
 
 	GLint lwidth, lheight;
 	SDL_GetWindowSize(g_window, &lwidth, &lheight);
 
 	const int n_channels = 3;
-	img.resize(lwidth * lheight * n_channels);
 
-	glReadPixels(0, 0, lwidth, lheight, GL_RGB, GL_UNSIGNED_BYTE, img.data());
+	// Several screenshots in the same second (e.g. when capturing every
+	// frame) get a sequence number
+	static std::string last_time_stamp;
+	static int same_time_stamp_count = 0;
+	std::time_t tt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	std::stringstream time_stamp;
+	time_stamp << std::put_time(std::localtime(&tt), "%Y-%m-%d_%H-%M-%S");
+	std::stringstream fname;
+	fname << time_stamp.str();
+	if(time_stamp.str() == last_time_stamp)
+	{
+		fname << "_" << ++same_time_stamp_count;
+	}
+	else
+	{
+		last_time_stamp = time_stamp.str();
+		same_time_stamp_count = 0;
+	}
+	fname << ".png";
+
+	PendingScreenshot screenshot;
+	screenshot.filename = fname.str();
+	screenshot.width = lwidth;
+	screenshot.height = lheight;
+	glGenBuffers(1, &screenshot.pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, screenshot.pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, lwidth * lheight * n_channels, nullptr, GL_STREAM_READ);
+	// Rows of RGB bytes are not necessarily a multiple of 4 bytes long
+	GLint pack_alignment;
+	glGetIntegerv(GL_PACK_ALIGNMENT, &pack_alignment);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, lwidth, lheight, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+	glPixelStorei(GL_PACK_ALIGNMENT, pack_alignment);
+	screenshot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	pending_screenshots.push_back(screenshot);
+}
 
-	for(int r = 0; r < lheight / 2; ++r)
+static void finishScreenshots(bool wait)
+{
+	const int n_channels = 3;
+	if(wait && !pending_screenshots.empty())
 	{
-		int a = r * lwidth * n_channels;
-		int b = (lheight - 1 - r) * lwidth * n_channels;
-		for(int c = 0; c < lwidth * n_channels; ++c)
+		// Let the GPU complete every read back, so that no screenshot is lost
+		glFinish();
+	}
+	auto is_finished = [wait](PendingScreenshot& screenshot) {
+		GLenum status = glClientWaitSync(screenshot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while(wait && status == GL_TIMEOUT_EXPIRED)
 		{
-			std::swap(img[a + c], img[b + c]);
+			status = glClientWaitSync(screenshot.fence, 0, GLuint64(1000000000));
+		}
+		if(status == GL_TIMEOUT_EXPIRED)
+		{
+			return false;
+		}
+		glDeleteSync(screenshot.fence);
+		if(status == GL_WAIT_FAILED)
+		{
+			std::cout << "Failed to read back screenshot " << screenshot.filename << std::endl;
+			glDeleteBuffers(1, &screenshot.pbo);
+			return true;
 		}
-	}
-
 
-	std::time_t tt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-	std::stringstream fname;
-	fname << std::put_time(std::localtime(&tt), "%Y-%m-%d_%H-%M-%S") << ".png";
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, screenshot.pbo);
+		const size_t row_size = size_t(screenshot.width) * n_channels;
+		const uint8_t* pixels = (const uint8_t*)glMapBufferRange(
+		    GL_PIXEL_PACK_BUFFER, 0, row_size * screenshot.height, GL_MAP_READ_BIT);
+		if(pixels)
+		{
+			std::vector<uint8_t> img(row_size * screenshot.height);
+			for(int r = 0; r < screenshot.height; ++r)
+			{
+				const uint8_t* row = pixels + (screenshot.height - 1 - r) * row_size;
+				std::copy(row, row + row_size, &img[r * row_size]);
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			writePngAsync(screenshot.filename, screenshot.width, screenshot.height, n_channels,
+			              std::move(img));
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glDeleteBuffers(1, &screenshot.pbo);
+		return true;
+	};
+	pending_screenshots.erase(
+	    std::remove_if(pending_screenshots.begin(), pending_screenshots.end(), is_finished),
+	    pending_screenshots.end());
+}
 
-	stbi_write_png(fname.str().c_str(), lwidth, lheight, n_channels, img.data(), 0);
+void pollScreenshots()
+{
+	finishScreenshots(false);
 }
 
 void drawFullScreenQuad()
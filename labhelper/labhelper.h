@@ -150,9 +150,24 @@ GLuint createAddIndexBuffer(GLuint vertexArrayObject,
 
 
 ///////////////////////////////////////////////////////////////////////////
-/// Helper to set uniform variables in shaders, labeled SLOW because they find the location from string each time.
+/// Location of a uniform in a shader program. The location is found with
+/// glGetUniformLocation the first time and then cached per program. The
+/// cache of a program is cleared when it is (re)linked with
+/// linkShaderProgram.
+///////////////////////////////////////////////////////////////////////////
+GLint getUniformLocation(GLuint shaderProgram, const char* name);
+
+///////////////////////////////////////////////////////////////////////////
+/// Index of a uniform block in a shader program, or GL_INVALID_INDEX if
+/// the program has no such block. Cached just like getUniformLocation.
+///////////////////////////////////////////////////////////////////////////
+GLuint getUniformBlockIndex(GLuint shaderProgram, const char* name);
+
+///////////////////////////////////////////////////////////////////////////
+/// Helper to set uniform variables in shaders, labeled SLOW because they find the location from a string.
+/// The locations are cached (see getUniformLocation), but the name is still hashed on every call.
 /// In OpenGL (and similarly in other APIs) it is much more efficient (in terms of CPU time) to keep the uniform
-/// location, and use that. Or even better, use uniform buffers!
+/// location, and use that. Or even better, use uniform buffers (as labhelper::render does for materials)!
 /// However, in the simple tutorial samples, performance is not an issue.
 /// Overloaded to set many types.
 ///////////////////////////////////////////////////////////////////////////
@@ -186,10 +201,18 @@ void debugDrawDisc();
 
 
 ///////////////////////////////////////////////////////////////////////////
-/// Takes the image in the default framebuffer and stores it in a file
+/// Takes the image in the default framebuffer and stores it in a file.
+/// The pixels are read back asynchronously and written by the encoder
+/// threads (see encoder.h), once pollScreenshots() finds them ready.
 ///////////////////////////////////////////////////////////////////////////
 void saveScreenshot();
 
+///////////////////////////////////////////////////////////////////////////
+/// Hand screenshots whose read back has finished to the encoder threads.
+/// Call once per frame. shutDown() waits for the remaining ones.
+///////////////////////////////////////////////////////////////////////////
+void pollScreenshots();
+
 ///////////////////////////////////////////////////////////////////////////
 /// Generates random, uniformly distributed floating point
 /// numbers in the interval [from, to].
@@ -0,0 +1,518 @@
+#include "profiler.h"
+#include "encoder.h"
+#include <GL/glew.h>
+#include <imgui.h>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+namespace labhelper
+{
+struct ProfileEvent
+{
+	const char* name;
+	// Nanoseconds since the profiler started
+	int64_t start;
+	int64_t end;
+	uint32_t thread;
+	int depth;
+	bool gpu;
+};
+
+static int64_t profilerTime()
+{
+	static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch)
+	    .count();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Every thread appends its finished scopes to a log of its own, so the
+// only contention is with profilerNewFrame() emptying the logs once per
+// frame. A log is freed once its thread has exited and the log has been
+// emptied. If the logs are not emptied (profilerNewFrame() is not
+// called), a thread stops logging at a limit.
+///////////////////////////////////////////////////////////////////////////
+const size_t max_events_per_thread = 1 << 16;
+
+struct ThreadLog
+{
+	std::mutex mutex;
+	std::vector<ProfileEvent> events;
+	uint32_t thread;
+	// Number of open scopes, only used by the owning thread
+	int depth = 0;
+	bool thread_exited = false;
+};
+
+static std::mutex thread_logs_mutex;
+static std::vector<std::unique_ptr<ThreadLog>> thread_logs;
+static uint32_t thread_count = 0;
+
+// Tells the profiler when its thread exits
+struct LocalThreadLog
+{
+	ThreadLog* log = nullptr;
+	~LocalThreadLog()
+	{
+		if(log != nullptr)
+		{
+			std::lock_guard<std::mutex> lock(log->mutex);
+			log->thread_exited = true;
+		}
+	}
+};
+static thread_local LocalThreadLog local_thread_log;
+
+static ThreadLog& threadLog()
+{
+	if(local_thread_log.log == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(thread_logs_mutex);
+		thread_logs.emplace_back(new ThreadLog);
+		local_thread_log.log = thread_logs.back().get();
+		local_thread_log.log->thread = thread_count++;
+	}
+	return *local_thread_log.log;
+}
+
+ProfileScope::ProfileScope(const char* name) : name(name)
+{
+	depth = threadLog().depth++;
+	start = profilerTime();
+}
+
+ProfileScope::~ProfileScope()
+{
+	const int64_t end = profilerTime();
+	ThreadLog& log = threadLog();
+	log.depth--;
+	std::lock_guard<std::mutex> lock(log.mutex);
+	if(log.events.size() < max_events_per_thread)
+	{
+		log.events.push_back({ name, start, end, log.thread, depth, false });
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// A GPU scope writes a timestamp query at each end. The queries of a
+// frame are read once the GPU has passed the last of them, which takes a
+// frame or two, so a ring of frames is recorded meanwhile. If the GPU
+// falls so far behind that the next frame in the ring is still waiting
+// for results, the scopes of the new frame are not timed, rather than
+// stalling until the results arrive.
+///////////////////////////////////////////////////////////////////////////
+const int gpu_frame_count = 4;
+
+struct GpuScope
+{
+	const char* name;
+	int depth;
+};
+
+struct GpuFrame
+{
+	// The begin and end query of each scope. Grown as needed and reused.
+	std::vector<GLuint> queries;
+	std::vector<GpuScope> scopes;
+	// The query that was issued last, and so completes last
+	GLuint last_query = 0;
+	// Waiting for query results
+	bool pending = false;
+};
+
+static GpuFrame gpu_frames[gpu_frame_count];
+static int gpu_frame_index = 0;
+static int gpu_depth = 0;
+static size_t untimed_gpu_scopes = 0;
+// Added to GPU timestamps to get profiler time
+static int64_t gpu_time_offset = 0;
+static bool gpu_time_offset_valid = false;
+
+static void calibrateGpuTime()
+{
+	// The timestamp of the GPU reaching this point in the command stream,
+	// without waiting for it
+	GLint64 gpu_now = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+	gpu_time_offset = profilerTime() - gpu_now;
+	gpu_time_offset_valid = true;
+}
+
+GpuProfileScope::GpuProfileScope(const char* name) : cpu_scope(name), index(-1)
+{
+	GpuFrame& frame = gpu_frames[gpu_frame_index];
+	if(frame.pending)
+	{
+		untimed_gpu_scopes++;
+		return;
+	}
+	if(!gpu_time_offset_valid)
+	{
+		calibrateGpuTime();
+	}
+	index = int(frame.scopes.size());
+	frame.scopes.push_back({ name, gpu_depth++ });
+	if(frame.queries.size() < frame.scopes.size() * 2)
+	{
+		frame.queries.resize(frame.scopes.size() * 2);
+		glGenQueries(2, &frame.queries[index * 2]);
+	}
+	glQueryCounter(frame.queries[index * 2], GL_TIMESTAMP);
+}
+
+GpuProfileScope::~GpuProfileScope()
+{
+	if(index < 0)
+	{
+		return;
+	}
+	gpu_depth--;
+	GpuFrame& frame = gpu_frames[gpu_frame_index];
+	frame.last_query = frame.queries[index * 2 + 1];
+	glQueryCounter(frame.last_query, GL_TIMESTAMP);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Per scope statistics for the overlay, in the order the scopes were
+// first seen. The times are the total of all calls (on all threads) in a
+// frame, smoothed over frames.
+///////////////////////////////////////////////////////////////////////////
+const float stats_smoothing = 0.05f;
+
+struct ScopeStats
+{
+	std::string name;
+	// Smallest depth the scope was seen at, for indenting
+	int depth;
+	float cpu_ms = 0.0f;
+	float gpu_ms = 0.0f;
+	bool has_cpu = false;
+	bool has_gpu = false;
+};
+
+static std::vector<ScopeStats> scope_stats;
+static std::unordered_map<std::string, size_t> scope_stats_by_name;
+// Lookups by the name pointer, to avoid building strings for every event
+static std::unordered_map<const char*, size_t> scope_stats_by_pointer;
+static float frame_ms = 0.0f;
+static int64_t frame_start = 0;
+
+static size_t scopeStatsIndex(const char* name, int depth)
+{
+	auto pointer_it = scope_stats_by_pointer.find(name);
+	if(pointer_it != scope_stats_by_pointer.end())
+	{
+		scope_stats[pointer_it->second].depth = std::min(scope_stats[pointer_it->second].depth, depth);
+		return pointer_it->second;
+	}
+	auto name_it = scope_stats_by_name.find(name);
+	if(name_it == scope_stats_by_name.end())
+	{
+		ScopeStats stats;
+		stats.name = name;
+		stats.depth = depth;
+		scope_stats.push_back(stats);
+		name_it = scope_stats_by_name.insert({ name, scope_stats.size() - 1 }).first;
+	}
+	scope_stats_by_pointer[name] = name_it->second;
+	return name_it->second;
+}
+
+// Add one frame's worth of CPU or GPU events to the averages. Scopes that
+// did not run count as zero.
+static void addStatsSample(const std::vector<ProfileEvent>& events, bool gpu)
+{
+	std::vector<float> total_ms(scope_stats.size(), 0.0f);
+	std::vector<char> ran(scope_stats.size(), 0);
+	for(const ProfileEvent& event : events)
+	{
+		const size_t index = scopeStatsIndex(event.name, event.depth);
+		total_ms.resize(scope_stats.size(), 0.0f);
+		ran.resize(scope_stats.size(), 0);
+		total_ms[index] += float(event.end - event.start) * 1e-6f;
+		ran[index] = 1;
+	}
+	for(size_t i = 0; i < scope_stats.size(); i++)
+	{
+		bool& has_time = gpu ? scope_stats[i].has_gpu : scope_stats[i].has_cpu;
+		float& average = gpu ? scope_stats[i].gpu_ms : scope_stats[i].cpu_ms;
+		if(has_time)
+		{
+			average += (total_ms[i] - average) * stats_smoothing;
+		}
+		else if(ran[i])
+		{
+			average = total_ms[i];
+			has_time = true;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Trace capture
+///////////////////////////////////////////////////////////////////////////
+const size_t max_capture_events = 1 << 20;
+
+static bool capturing = false;
+static int64_t capture_start = 0;
+static std::vector<ProfileEvent> capture_events;
+static size_t dropped_capture_events = 0;
+
+static void captureEvents(const std::vector<ProfileEvent>& events)
+{
+	for(const ProfileEvent& event : events)
+	{
+		if(event.start < capture_start)
+		{
+			continue;
+		}
+		if(capture_events.size() < max_capture_events)
+		{
+			capture_events.push_back(event);
+		}
+		else
+		{
+			dropped_capture_events++;
+		}
+	}
+}
+
+void profilerNewFrame()
+{
+	const int64_t now = profilerTime();
+	const ProfileEvent frame_event = { "Frame", frame_start, now, threadLog().thread, 0, false };
+	const float last_frame_ms = float(now - frame_start) * 1e-6f;
+	frame_ms = frame_start == 0 ? last_frame_ms : frame_ms + (last_frame_ms - frame_ms) * stats_smoothing;
+	frame_start = now;
+
+	///////////////////////////////////////////////////////////////////////////
+	// Empty the thread logs
+	///////////////////////////////////////////////////////////////////////////
+	static std::vector<ProfileEvent> events;
+	events.clear();
+	{
+		std::lock_guard<std::mutex> lock(thread_logs_mutex);
+		for(size_t i = 0; i < thread_logs.size();)
+		{
+			bool thread_exited;
+			{
+				std::lock_guard<std::mutex> log_lock(thread_logs[i]->mutex);
+				events.insert(events.end(), thread_logs[i]->events.begin(), thread_logs[i]->events.end());
+				thread_logs[i]->events.clear();
+				thread_exited = thread_logs[i]->thread_exited;
+			}
+			if(thread_exited)
+			{
+				thread_logs.erase(thread_logs.begin() + i);
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+	addStatsSample(events, false);
+	if(capturing)
+	{
+		captureEvents(std::vector<ProfileEvent>(1, frame_event));
+		captureEvents(events);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Move on to the next GPU frame, and read the results of the frames
+	// that the GPU has finished, oldest first
+	///////////////////////////////////////////////////////////////////////////
+	if(!gpu_frames[gpu_frame_index].scopes.empty())
+	{
+		gpu_frames[gpu_frame_index].pending = true;
+	}
+	gpu_frame_index = (gpu_frame_index + 1) % gpu_frame_count;
+	for(int i = 0; i < gpu_frame_count; i++)
+	{
+		GpuFrame& frame = gpu_frames[(gpu_frame_index + i) % gpu_frame_count];
+		if(!frame.pending)
+		{
+			continue;
+		}
+		GLint available = 0;
+		glGetQueryObjectiv(frame.last_query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if(!available)
+		{
+			// Later frames can't be done either
+			break;
+		}
+		events.clear();
+		for(size_t s = 0; s < frame.scopes.size(); s++)
+		{
+			GLuint64 begin, end;
+			glGetQueryObjectui64v(frame.queries[s * 2], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(frame.queries[s * 2 + 1], GL_QUERY_RESULT, &end);
+			events.push_back({ frame.scopes[s].name, int64_t(begin) + gpu_time_offset,
+			                   int64_t(end) + gpu_time_offset, 0, frame.scopes[s].depth, true });
+		}
+		frame.scopes.clear();
+		frame.pending = false;
+		addStatsSample(events, true);
+		if(capturing)
+		{
+			captureEvents(events);
+		}
+	}
+}
+
+void profilerGui()
+{
+	ImGui::Begin("Profiler");
+	ImGui::Text("Frame: %.2f ms", frame_ms);
+	ImGui::Columns(3, "profiler_scopes");
+	ImGui::Text("Scope");
+	ImGui::NextColumn();
+	ImGui::Text("CPU ms");
+	ImGui::NextColumn();
+	ImGui::Text("GPU ms");
+	ImGui::NextColumn();
+	ImGui::Separator();
+	for(const ScopeStats& stats : scope_stats)
+	{
+		ImGui::Text("%*s%s", 2 * stats.depth, "", stats.name.c_str());
+		ImGui::NextColumn();
+		if(stats.has_cpu)
+		{
+			ImGui::Text("%.3f", stats.cpu_ms);
+		}
+		ImGui::NextColumn();
+		if(stats.has_gpu)
+		{
+			ImGui::Text("%.3f", stats.gpu_ms);
+		}
+		ImGui::NextColumn();
+	}
+	ImGui::Columns(1);
+	ImGui::Separator();
+	ImGui::TextDisabled("CPU times are summed over all threads");
+	if(untimed_gpu_scopes > 0)
+	{
+		ImGui::Text("GPU scopes not timed (GPU too far behind): %d", int(untimed_gpu_scopes));
+	}
+
+	if(!capturing)
+	{
+		if(ImGui::Button("Start trace capture"))
+		{
+			startProfilerCapture();
+		}
+	}
+	else
+	{
+		ImGui::Text("Captured %d events", int(capture_events.size()));
+		if(ImGui::Button("Save trace"))
+		{
+			std::time_t tt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+			std::stringstream filename;
+			filename << "trace_" << std::put_time(std::localtime(&tt), "%Y-%m-%d_%H-%M-%S") << ".json";
+			saveProfilerCapture(filename.str());
+		}
+	}
+	ImGui::End();
+}
+
+void startProfilerCapture()
+{
+	capturing = true;
+	capture_start = profilerTime();
+	capture_events.clear();
+	dropped_capture_events = 0;
+	// Realign the clocks, in case they have drifted
+	if(gpu_time_offset_valid)
+	{
+		calibrateGpuTime();
+	}
+}
+
+bool isProfilerCapturing()
+{
+	return capturing;
+}
+
+static void writeJsonString(std::ostream& out, const char* s)
+{
+	out << '"';
+	for(; *s != '\0'; s++)
+	{
+		if(*s == '"' || *s == '\\')
+		{
+			out << '\\';
+		}
+		out << *s;
+	}
+	out << '"';
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Chrome's trace_event format: complete ("X") events with times in
+// microseconds, CPU threads in one process and the GPU in another
+///////////////////////////////////////////////////////////////////////////
+static void writeChromeTrace(const std::string& filename,
+                             const std::vector<ProfileEvent>& events,
+                             int64_t start)
+{
+	std::ofstream file(filename);
+	if(!file)
+	{
+		std::cout << "Failed to write " << filename << "\n";
+		return;
+	}
+	file << "{\"traceEvents\":[\n";
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GPU\"}}";
+	std::set<uint32_t> threads;
+	for(const ProfileEvent& event : events)
+	{
+		if(!event.gpu)
+		{
+			threads.insert(event.thread);
+		}
+	}
+	for(uint32_t thread : threads)
+	{
+		file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << thread
+		     << ",\"args\":{\"name\":\"Thread " << thread << "\"}}";
+	}
+	file << std::fixed << std::setprecision(3);
+	for(const ProfileEvent& event : events)
+	{
+		file << ",\n{\"name\":";
+		writeJsonString(file, event.name);
+		file << ",\"cat\":\"" << (event.gpu ? "gpu" : "cpu") << "\",\"ph\":\"X\"";
+		file << ",\"pid\":" << (event.gpu ? 1 : 0) << ",\"tid\":" << event.thread;
+		file << ",\"ts\":" << double(event.start - start) * 1e-3;
+		file << ",\"dur\":" << double(event.end - event.start) * 1e-3 << "}";
+	}
+	file << "\n]}\n";
+	std::cout << "Wrote profiler trace " << filename << "\n";
+}
+
+void saveProfilerCapture(const std::string& filename)
+{
+	if(dropped_capture_events > 0)
+	{
+		std::cout << "Profiler capture was full, " << dropped_capture_events << " events were dropped\n";
+	}
+	capturing = false;
+	// std::function must be copyable, so the events are shared
+	auto events = std::make_shared<std::vector<ProfileEvent>>();
+	events->swap(capture_events);
+	const int64_t start = capture_start;
+	queueEncodeJob([filename, events, start]() { writeChromeTrace(filename, *events, start); });
+}
+} // namespace labhelper
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// A small frame profiler. CPU scopes time a block of code on the thread
+/// that runs it (any thread). GPU scopes time the GL commands issued in a
+/// block with timestamp queries; the results are read back a few frames
+/// later, without waiting for the GPU. profilerGui() shows the average
+/// time per scope, and during a capture every scope is recorded and
+/// written as a Chrome trace (open it in chrome://tracing or
+/// ui.perfetto.dev) to see the passes and threads of each frame.
+///
+/// Only the pointer to a scope name is kept, so names must be string
+/// literals (or otherwise live as long as the program).
+///////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////
+/// Times its own lifetime on the calling thread
+///////////////////////////////////////////////////////////////////////////
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name);
+	~ProfileScope();
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char* name;
+	int64_t start;
+	int depth;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Times the GL commands issued during its lifetime, as well as the CPU
+/// time spent issuing them. Must only be used on the thread that owns the
+/// GL context.
+///////////////////////////////////////////////////////////////////////////
+class GpuProfileScope
+{
+public:
+	explicit GpuProfileScope(const char* name);
+	~GpuProfileScope();
+	GpuProfileScope(const GpuProfileScope&) = delete;
+	GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+
+private:
+	ProfileScope cpu_scope;
+	// Index of the scope in the current GPU frame, or -1 if it isn't timed
+	int index;
+};
+
+#define LABHELPER_PROFILE_CONCAT_(a, b) a##b
+#define LABHELPER_PROFILE_CONCAT(a, b) LABHELPER_PROFILE_CONCAT_(a, b)
+// Time the rest of the enclosing block
+#define PROFILE_SCOPE(name) labhelper::ProfileScope LABHELPER_PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name)                                                                            \
+	labhelper::GpuProfileScope LABHELPER_PROFILE_CONCAT(gpu_profile_scope_, __LINE__)(name)
+
+///////////////////////////////////////////////////////////////////////////
+/// Call once per frame, after swapping buffers. Collects the scopes that
+/// finished since the last call and the GPU results that have arrived.
+///////////////////////////////////////////////////////////////////////////
+void profilerNewFrame();
+
+///////////////////////////////////////////////////////////////////////////
+/// Draw a window with the average CPU and GPU time of each scope, and
+/// buttons to capture a trace
+///////////////////////////////////////////////////////////////////////////
+void profilerGui();
+
+///////////////////////////////////////////////////////////////////////////
+/// Record every scope from now on, until the capture is saved
+///////////////////////////////////////////////////////////////////////////
+void startProfilerCapture();
+bool isProfilerCapturing();
+
+///////////////////////////////////////////////////////////////////////////
+/// End the capture and write it as Chrome trace_event JSON. The file is
+/// written on an encoder thread (see encoder.h).
+///////////////////////////////////////////////////////////////////////////
+void saveProfilerCapture(const std::string& filename);
+} // namespace labhelper
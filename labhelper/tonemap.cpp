@@ -0,0 +1,263 @@
+#include "tonemap.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TONEMAP_SSE2 1
+#endif
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+// The kernel is written once, for a "batch" of floats that is a plain
+// float or an SSE2 register. Each batch type provides arithmetic,
+// min/max, sqrt, select and a conversion of values in [0, 256) to bytes
+// (by truncation).
+///////////////////////////////////////////////////////////////////////////
+struct Batch1
+{
+	static const int width = 1;
+	float v;
+	Batch1(float x) : v(x) {}
+	static Batch1 load(const float* p)
+	{
+		return Batch1(*p);
+	}
+	void storeBytes(uint8_t* p) const
+	{
+		p[0] = uint8_t(v);
+	}
+};
+inline Batch1 operator+(Batch1 a, Batch1 b)
+{
+	return Batch1(a.v + b.v);
+}
+inline Batch1 operator-(Batch1 a, Batch1 b)
+{
+	return Batch1(a.v - b.v);
+}
+inline Batch1 operator*(Batch1 a, Batch1 b)
+{
+	return Batch1(a.v * b.v);
+}
+inline Batch1 operator/(Batch1 a, Batch1 b)
+{
+	return Batch1(a.v / b.v);
+}
+// Like minps / maxps, return b if either is NaN
+inline Batch1 min(Batch1 a, Batch1 b)
+{
+	return a.v < b.v ? a : b;
+}
+inline Batch1 max(Batch1 a, Batch1 b)
+{
+	return a.v > b.v ? a : b;
+}
+inline Batch1 sqrt(Batch1 a)
+{
+	return Batch1(std::sqrt(a.v));
+}
+// a <= b ? x : y
+inline Batch1 selectLessEqual(Batch1 a, Batch1 b, Batch1 x, Batch1 y)
+{
+	return a.v <= b.v ? x : y;
+}
+
+#if TONEMAP_SSE2
+struct Batch4
+{
+	static const int width = 4;
+	__m128 v;
+	Batch4(__m128 x) : v(x) {}
+	Batch4(float x) : v(_mm_set1_ps(x)) {}
+	static Batch4 load(const float* p)
+	{
+		return Batch4(_mm_loadu_ps(p));
+	}
+	void storeBytes(uint8_t* p) const
+	{
+		const __m128i i = _mm_cvttps_epi32(v);
+		const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(i, i), _mm_setzero_si128());
+		const int packed = _mm_cvtsi128_si32(bytes);
+		std::copy((const uint8_t*)&packed, (const uint8_t*)&packed + 4, p);
+	}
+};
+inline Batch4 operator+(Batch4 a, Batch4 b)
+{
+	return Batch4(_mm_add_ps(a.v, b.v));
+}
+inline Batch4 operator-(Batch4 a, Batch4 b)
+{
+	return Batch4(_mm_sub_ps(a.v, b.v));
+}
+inline Batch4 operator*(Batch4 a, Batch4 b)
+{
+	return Batch4(_mm_mul_ps(a.v, b.v));
+}
+inline Batch4 operator/(Batch4 a, Batch4 b)
+{
+	return Batch4(_mm_div_ps(a.v, b.v));
+}
+inline Batch4 min(Batch4 a, Batch4 b)
+{
+	return Batch4(_mm_min_ps(a.v, b.v));
+}
+inline Batch4 max(Batch4 a, Batch4 b)
+{
+	return Batch4(_mm_max_ps(a.v, b.v));
+}
+inline Batch4 sqrt(Batch4 a)
+{
+	return Batch4(_mm_sqrt_ps(a.v));
+}
+inline Batch4 selectLessEqual(Batch4 a, Batch4 b, Batch4 x, Batch4 y)
+{
+	const __m128 mask = _mm_cmple_ps(a.v, b.v);
+	return Batch4(_mm_or_ps(_mm_and_ps(mask, x.v), _mm_andnot_ps(mask, y.v)));
+}
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////
+// sRGB transfer function without pow(): Taylor's fit in square roots gets
+// within 1e-3, and a Newton step on t^12 = c^5 (t = c^(5/12)) brings it
+// to 1e-4, well below the 8 bit step.
+///////////////////////////////////////////////////////////////////////////
+template<typename B>
+static inline B srgbEncode(B c)
+{
+	const B s1 = sqrt(c);
+	const B s2 = sqrt(s1);
+	const B s3 = sqrt(s2);
+	const B approximation = B(0.662002687f) * s1 + B(0.684122060f) * s2 - B(0.323583601f) * s3
+	                        - B(0.0225411470f) * c;
+	B t = (approximation + B(0.055f)) * B(1.0f / 1.055f);
+	const B t2 = t * t;
+	const B t4 = t2 * t2;
+	const B t11 = t4 * t4 * t2 * t;
+	const B c2 = c * c;
+	t = t * B(11.0f / 12.0f) + (c2 * c2 * c) / (B(12.0f) * t11);
+	return selectLessEqual(c, B(0.0031308f), B(12.92f) * c, B(1.055f) * t - B(0.055f));
+}
+
+template<typename B>
+static inline B toneMapValue(B x, const ToneMapSettings& settings)
+{
+	x = max(x * B(settings.exposure), B(0.0f));
+	switch(settings.tone_operator)
+	{
+	case TONEMAP_CLAMP:
+		x = min(x, B(1.0f));
+		break;
+	case TONEMAP_REINHARD:
+		x = x / (x + B(1.0f));
+		break;
+	case TONEMAP_ACES:
+		x = min((x * (B(2.51f) * x + B(0.03f))) / (x * (B(2.43f) * x + B(0.59f)) + B(0.14f)), B(1.0f));
+		break;
+	}
+	if(settings.srgb)
+	{
+		x = srgbEncode(x);
+	}
+	return x;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Tone map `count` floats. The offsets added before truncating to bytes
+// repeat every 8 pixels (24 floats), so a batch never straddles the end
+// of `offsets` as long as it starts at a multiple of its width.
+///////////////////////////////////////////////////////////////////////////
+template<typename B>
+static int toneMapSpan(const float* in, uint8_t* out, int count, const float* offsets,
+                       const ToneMapSettings& settings)
+{
+	int i = 0;
+	for(; i + B::width <= count; i += B::width)
+	{
+		const B x = toneMapValue(B::load(in + i), settings);
+		min(x * B(255.0f) + B::load(offsets + i % 24), B(255.0f)).storeBytes(out + i);
+	}
+	return i;
+}
+
+static void toneMapRow(const float* in, uint8_t* out, int count, const float* offsets,
+                       const ToneMapSettings& settings)
+{
+	int done = 0;
+#if TONEMAP_SSE2
+	done = toneMapSpan<Batch4>(in, out, count, offsets, settings);
+#endif
+	done += toneMapSpan<Batch1>(in + done, out + done, count - done, offsets + done % 24, settings);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Threshold (in [0, 1)) of pixel (x, y) in an 8x8 Bayer matrix: the bits
+// of x ^ y and y interleaved, least significant first.
+///////////////////////////////////////////////////////////////////////////
+static float bayerThreshold(int x, int y)
+{
+	int v = 0;
+	for(int bit = 0; bit < 3; bit++)
+	{
+		v |= (((x ^ y) >> bit) & 1) << (5 - 2 * bit);
+		v |= ((y >> bit) & 1) << (4 - 2 * bit);
+	}
+	return (v + 0.5f) / 64.0f;
+}
+
+void toneMapImage(const float* rgb, int width, int height, const ToneMapSettings& settings, uint8_t* out)
+{
+	// Per row of the dither pattern, the offset for each float of 8 pixels
+	float offsets[8][24];
+	for(int y = 0; y < 8; y++)
+	{
+		for(int x = 0; x < 24; x++)
+		{
+			offsets[y][x] = settings.dither ? bayerThreshold(x / 3, y) : 0.5f;
+		}
+	}
+
+	const int row_floats = width * 3;
+	auto toneMapRows = [&](int y0, int y1) {
+		for(int y = y0; y < y1; y++)
+		{
+			const int source_row = settings.flip_vertically ? height - 1 - y : y;
+			toneMapRow(rgb + size_t(source_row) * row_floats, out + size_t(y) * row_floats, row_floats,
+			           offsets[y % 8], settings);
+		}
+	};
+
+	// Split the rows evenly over the hardware threads, unless the image is
+	// too small for that to pay off
+	const int min_rows_per_thread = 16;
+	int thread_count = int(std::max(1u, std::thread::hardware_concurrency()));
+	thread_count = std::max(1, std::min(thread_count, height / min_rows_per_thread));
+	std::vector<std::thread> threads;
+	for(int t = 1; t < thread_count; t++)
+	{
+		threads.emplace_back(toneMapRows, int(int64_t(height) * t / thread_count),
+		                     int(int64_t(height) * (t + 1) / thread_count));
+	}
+	toneMapRows(0, int(int64_t(height) / thread_count));
+	for(auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+std::vector<uint8_t> toneMapImage(const std::vector<glm::vec3>& image,
+                                  int width,
+                                  int height,
+                                  const ToneMapSettings& settings)
+{
+	std::vector<uint8_t> out(size_t(width) * height * 3);
+	if(!out.empty())
+	{
+		toneMapImage(&image[0].x, width, height, settings, out.data());
+	}
+	return out;
+}
+} // namespace labhelper
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// Conversion of linear HDR images to 8 bit RGB, for writing PNG files
+///////////////////////////////////////////////////////////////////////////
+enum ToneMapOperator
+{
+	// Values above 1 are clipped
+	TONEMAP_CLAMP = 0,
+	// x / (1 + x)
+	TONEMAP_REINHARD = 1,
+	// Narkowicz' fit of the ACES filmic curve
+	TONEMAP_ACES = 2,
+};
+
+struct ToneMapSettings
+{
+	// Linear scale applied before the tone curve
+	float exposure = 1.0f;
+	ToneMapOperator tone_operator = TONEMAP_CLAMP;
+	// Encode with the sRGB transfer function. Otherwise the (tone mapped)
+	// linear values are written, which is what the labs display.
+	bool srgb = false;
+	// Quantize with an 8x8 ordered dither instead of rounding, which
+	// hides banding in smooth gradients
+	bool dither = false;
+	// Write the rows in reverse order (GL images are stored bottom row
+	// first)
+	bool flip_vertically = false;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Tone map `rgb` (width * height pixels of three floats) into `out`
+/// (width * height * 3 bytes). Rows are processed in parallel, with SSE2
+/// and a scalar fallback.
+///////////////////////////////////////////////////////////////////////////
+void toneMapImage(const float* rgb, int width, int height, const ToneMapSettings& settings, uint8_t* out);
+std::vector<uint8_t> toneMapImage(const std::vector<glm::vec3>& image,
+                                  int width,
+                                  int height,
+                                  const ToneMapSettings& settings);
+} // namespace labhelper
@@ -13,11 +13,17 @@ void HDRImage::load(const string& filename)
 		std::cout << "Failed to load image: " << filename << ".\n";
 		exit(1);
 	}
+	// A latitude-longitude map wraps around horizontally, but not past
+	// the poles
+	texture.build(data, width, height, 3, pathtracer::TEXTURE_WRAP_REPEAT, pathtracer::TEXTURE_WRAP_CLAMP);
 };
 
-vec3 HDRImage::sample(float u, float v)
+vec3 HDRImage::sample(float u, float v) const
 {
-	int x = int(u * width) % width;
-	int y = int(v * height) % height;
-	return vec3(data[(y * width + x) * 3 + 0], data[(y * width + x) * 3 + 1], data[(y * width + x) * 3 + 2]);
+	return vec3(texture.sampleBilinear(vec2(u, v)));
+}
+
+vec3 HDRImage::sample(float u, float v, float texels) const
+{
+	return vec3(texture.sampleTrilinear(vec2(u, v), texels));
 }
@@ -2,14 +2,17 @@
 #include <stb_image.h>
 #include <string>
 #include <glm/glm.hpp>
+#include "texture.h"
 
 ///////////////////////////////////////////////////////////////////////////
-// Simple helper class for loading HDR images with STB image
+// Simple helper class for loading HDR images with STB image. Lookups are
+// filtered (see texture.h); `data` keeps the image as loaded.
 ///////////////////////////////////////////////////////////////////////////
 struct HDRImage
 {
 	int width, height, components;
 	float* data = nullptr;
+	pathtracer::FilteredTexture texture;
 	HDRImage(){};
 	~HDRImage()
 	{
@@ -17,5 +20,8 @@ struct HDRImage
 			stbi_image_free(data);
 	};
 	void load(const std::string& filename);
-	glm::vec3 sample(float u, float v);
-};
\ No newline at end of file
+	// Bilinear lookup. u wraps around, v is clamped.
+	glm::vec3 sample(float u, float v) const;
+	// Trilinear lookup for a footprint `texels` wide
+	glm::vec3 sample(float u, float v, float texels) const;
+};
@@ -6,7 +6,12 @@
 #include "material.h"
 #include "embree.h"
 #include "sampling.h"
+#include "tiles.h"
+#include "integrator.h"
+#include "wavefront.h"
+#include "volume.h"
 #include "labhelper.h"
+#include "profiler.h"
 
 using namespace std;
 using namespace glm;
@@ -28,8 +33,11 @@ std::vector<DiscLight> disc_lights;
 ///////////////////////////////////////////////////////////////////////////
 void restart()
 {
-	// No need to clear image,
+	// No need to clear image, but the per pixel statistics must be reset
 	rendered_image.number_of_samples = 0;
+	rendered_image.number_of_active_pixels = rendered_image.width * rendered_image.height;
+	std::fill(rendered_image.pixel_samples.begin(), rendered_image.pixel_samples.end(), 0);
+	std::fill(rendered_image.luminance_m2.begin(), rendered_image.luminance_m2.end(), 0.0f);
 }
 
 int getSampleCount()
@@ -46,53 +54,165 @@ void resize(int w, int h)
 	rendered_image.width = w / settings.subsampling;
 	rendered_image.height = h / settings.subsampling;
 	rendered_image.data.resize(rendered_image.width * rendered_image.height);
+	rendered_image.pixel_samples.resize(rendered_image.width * rendered_image.height);
+	rendered_image.luminance_m2.resize(rendered_image.width * rendered_image.height);
 	restart();
 }
 
-///////////////////////////////////////////////////////////////////////////
-/// Return the radiance from a certain direction wi from the environment
-/// map.
-///////////////////////////////////////////////////////////////////////////
-vec3 Lenvironment(const vec3& wi)
+float pixel_spread_angle = 0.0f;
+
+vec3 Lenvironment(const vec3& wi, float spread)
 {
 	const float theta = acos(std::max(-1.0f, std::min(1.0f, wi.y)));
 	float phi = atan(wi.z, wi.x);
 	if(phi < 0.0f)
 		phi = phi + 2.0f * M_PI;
 	vec2 lookup = vec2(phi / (2.0 * M_PI), 1 - theta / M_PI);
-	return environment.multiplier * environment.map.sample(lookup.x, lookup.y);
+	// The map has height / pi texels per radian (along a meridian)
+	const float texels = spread * float(environment.map.height) / float(M_PI);
+	return environment.multiplier * environment.map.sample(lookup.x, lookup.y, texels);
 }
 
-///////////////////////////////////////////////////////////////////////////
-/// Calculate the radiance going from one point (r.hitPosition()) in one
-/// direction (-r.d), through path tracing.
-///////////////////////////////////////////////////////////////////////////
-vec3 Li(Ray& primary_ray)
+PathVertex shadeVertex(const Ray& ray, float path_length, int bounce)
 {
-	vec3 L = vec3(0.0f);
-	vec3 path_throughput = vec3(1.0);
-	Ray current_ray = primary_ray;
+	PathVertex vertex;
 
 	///////////////////////////////////////////////////////////////////
 	// Get the intersection information from the ray
 	///////////////////////////////////////////////////////////////////
-	Intersection hit = getIntersection(current_ray);
+	Intersection hit = getIntersection(ray);
 	///////////////////////////////////////////////////////////////////
-	// Create a Material tree for evaluating brdfs and calculating
-	// sample directions.
+	// Copy the compiled material, and texture its color filtered over
+	// the pixel's footprint on the surface: the width of the cone of
+	// camera rays through the pixel at this distance along the path,
+	// stretched by the angle it hits the surface at.
 	///////////////////////////////////////////////////////////////////
-
-	Diffuse diffuse(hit.material->m_color);
-	BTDF& mat = diffuse;
+	CompiledMaterial mat = *hit.compiled_material;
+	if(mat.color_texture != nullptr && mat.type != MATERIAL_BLACK)
+	{
+		const float cos_theta = std::max(abs(dot(hit.wo, hit.geometry_normal)), 0.01f);
+		const float footprint = pixel_spread_angle * path_length * hit.uv_scale / cos_theta;
+		const float texture_size =
+		    sqrt(float(mat.color_texture->width()) * float(mat.color_texture->height()));
+		mat.color *= vec3(mat.color_texture->sampleTrilinear(hit.uv, footprint * texture_size));
+	}
+	///////////////////////////////////////////////////////////////////
+	// Emissive surfaces emit on the side their normals point to. Past
+	// the camera ray, emitters are only accounted for by sampling the
+	// lights, so they are not counted twice.
+	///////////////////////////////////////////////////////////////////
+	if(bounce == 0 && dot(hit.wo, hit.shading_normal) > 0.0f)
+	{
+		vertex.emitted = mat.emission;
+	}
+	if(mat.type == MATERIAL_BLACK)
+	{
+		return vertex;
+	}
 	///////////////////////////////////////////////////////////////////
-	// Calculate Direct Illumination from light.
+	// Calculate Direct Illumination from one of the lights, chosen by
+	// its estimated contribution at the hit point.
 	///////////////////////////////////////////////////////////////////
 	{
-		const float distance_to_light = length(point_light.position - hit.position);
-		const float falloff_factor = 1.0f / (distance_to_light * distance_to_light);
-		vec3 Li = point_light.intensity_multiplier * point_light.color * falloff_factor;
-		vec3 wi = normalize(point_light.position - hit.position);
-		L = mat.f(wi, hit.wo, hit.shading_normal) * Li * std::max(0.0f, dot(wi, hit.shading_normal));
+		LightSample sample = sampleLight(hit.position, hit.shading_normal, settings.light_selection);
+		const float cos_theta = dot(sample.wi, hit.shading_normal);
+		if(sample.pdf > 0.0f && cos_theta > 0.0f)
+		{
+			// Stop short of the light, so that emissive triangles don't
+			// shadow themselves
+			vertex.shadow_rays[vertex.shadow_count] = Ray(hit.position + EPSILON * hit.geometry_normal,
+			                                              sample.wi, 0.0f, sample.distance * (1.0f - 1e-3f));
+			const vec3 f = evaluateMaterial(mat, sample.wi, hit.wo, hit.shading_normal);
+			vertex.shadow_L[vertex.shadow_count] = f * sample.L * cos_theta / sample.pdf;
+			vertex.shadow_count++;
+		}
+	}
+	///////////////////////////////////////////////////////////////////
+	// Calculate Direct Illumination from the environment, with one
+	// direction sampled either from the bright parts of the map or
+	// from the brdf.
+	///////////////////////////////////////////////////////////////////
+	{
+		vec3 wi, Le, f;
+		float pdf;
+		if(settings.environment_importance_sampling)
+		{
+			EnvironmentSample sample =
+			    environment.distribution.sample(environment.map, environment.multiplier);
+			wi = sample.wi;
+			Le = sample.L;
+			pdf = sample.pdf;
+			f = evaluateMaterial(mat, wi, hit.wo, hit.shading_normal);
+		}
+		else
+		{
+			WiSample sample = sampleMaterial(mat, hit.wo, hit.shading_normal);
+			wi = sample.wi;
+			f = sample.f;
+			pdf = sample.pdf;
+			Le = Lenvironment(wi);
+		}
+		const float cos_theta = dot(wi, hit.shading_normal);
+		if(pdf > 0.0f && cos_theta > 0.0f && f != vec3(0.0f))
+		{
+			vertex.shadow_rays[vertex.shadow_count] = Ray(hit.position + EPSILON * hit.geometry_normal, wi);
+			vertex.shadow_L[vertex.shadow_count] = f * Le * cos_theta / pdf;
+			vertex.shadow_count++;
+		}
+	}
+	///////////////////////////////////////////////////////////////////
+	// Continue the path in a direction sampled from the brdf
+	///////////////////////////////////////////////////////////////////
+	if(bounce < settings.max_bounces)
+	{
+		WiSample sample = sampleMaterial(mat, hit.wo, hit.shading_normal);
+		const float cos_theta = dot(sample.wi, hit.shading_normal);
+		if(sample.pdf > 0.0f && cos_theta > 0.0f && sample.f != vec3(0.0f))
+		{
+			vertex.scattered = true;
+			vertex.next_ray = Ray(hit.position + EPSILON * hit.geometry_normal, sample.wi);
+			vertex.weight = sample.f * cos_theta / sample.pdf;
+		}
+	}
+	return vertex;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Calculate the radiance going from one point (r.hitPosition()) in one
+/// direction (-r.d), through path tracing. The path is followed for up to
+/// settings.max_bounces bounces, with the lights sampled at every vertex.
+///////////////////////////////////////////////////////////////////////////
+vec3 Li(Ray& primary_ray)
+{
+	vec3 L = vec3(0.0f);
+	vec3 path_throughput = vec3(1.0);
+	Ray current_ray = primary_ray;
+	float path_length = 0.0f;
+
+	for(int bounce = 0;; bounce++)
+	{
+		// The environment seen by a bounced ray has already been sampled
+		// as a light at the previous vertex
+		if(bounce > 0 && !intersect(current_ray))
+		{
+			break;
+		}
+		path_length += current_ray.tfar;
+		PathVertex vertex = shadeVertex(current_ray, path_length, bounce);
+		L += path_throughput * vertex.emitted;
+		for(int i = 0; i < vertex.shadow_count; i++)
+		{
+			if(!occluded(vertex.shadow_rays[i]))
+			{
+				L += path_throughput * vertex.shadow_L[i];
+			}
+		}
+		if(!vertex.scattered)
+		{
+			break;
+		}
+		path_throughput *= vertex.weight;
+		current_ray = vertex.next_ray;
 	}
 	// Return the final outgoing radiance for the primary ray
 	return L;
@@ -106,6 +226,151 @@ inline static glm::vec3 homogenize(const glm::vec4& p)
 	return glm::vec3(p * (1.f / p.w));
 }
 
+Ray generatePrimaryRay(int x, int y, const vec3& camera_pos, const mat4& inverse_PV)
+{
+	Ray primaryRay;
+	primaryRay.o = camera_pos;
+	vec2 screenCoord = vec2(float(x) / float(rendered_image.width), float(y) / float(rendered_image.height));
+	// Calculate direction
+	vec4 viewCoord = vec4(screenCoord.x * 2.0f - 1.0f, screenCoord.y * 2.0f - 1.0f, 1.0f, 1.0f);
+	vec3 p = homogenize(inverse_PV * viewCoord);
+	primaryRay.d = normalize(p - camera_pos);
+	return primaryRay;
+}
+
+bool isPixelActive(int x, int y)
+{
+	if(!settings.adaptive_sampling)
+	{
+		return true;
+	}
+	const int pixel = y * rendered_image.width + x;
+	const int n = rendered_image.pixel_samples[pixel];
+	if(n < std::max(settings.adaptive_min_samples, 2))
+	{
+		return true;
+	}
+	// Relative standard error of the mean luminance. The floor on the mean
+	// keeps (nearly) black pixels from requiring an infinite sample count.
+	const float mean = dot(rendered_image.data[pixel], vec3(0.2126f, 0.7152f, 0.0722f));
+	const float standard_error = sqrt(rendered_image.getVariance(pixel) / float(n));
+	return standard_error > settings.adaptive_error_threshold * std::max(mean, 0.01f);
+}
+
+void accumulateSample(int pixel, const vec3& color)
+{
+	const vec3 luminance_weights = vec3(0.2126f, 0.7152f, 0.0722f);
+	float n = float(rendered_image.pixel_samples[pixel]);
+	const float old_mean = dot(rendered_image.data[pixel], luminance_weights);
+	rendered_image.data[pixel] = rendered_image.data[pixel] * (n / (n + 1.0f)) + (1.0f / (n + 1.0f)) * color;
+	const float luminance = dot(color, luminance_weights);
+	const float new_mean = dot(rendered_image.data[pixel], luminance_weights);
+	rendered_image.luminance_m2[pixel] += (luminance - old_mean) * (luminance - new_mean);
+	rendered_image.pixel_samples[pixel] += 1;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Evaluate the radiance along a primary ray that has already been
+/// intersected with the scene, and accumulate it to pixel (x, y). Returns
+/// whether the pixel still needs more samples.
+///////////////////////////////////////////////////////////////////////////
+static bool shadePixel(int x, int y, Ray& primaryRay)
+{
+	const int pixel = y * rendered_image.width + x;
+	beginSample(pixel, rendered_image.pixel_samples[pixel], settings.sampler);
+	vec3 color;
+	if(primaryRay.geomID != RTC_INVALID_GEOMETRY_ID)
+	{
+		// If it hit something, evaluate the radiance from that point
+		color = Li(primaryRay);
+	}
+	else
+	{
+		// Otherwise evaluate environment
+		color = Lenvironment(primaryRay.d, pixel_spread_angle);
+	}
+	if(volume.enabled)
+	{
+		// Attenuate the radiance and add light scattered by the volume
+		const float t_surface = primaryRay.geomID != RTC_INVALID_GEOMETRY_ID ? primaryRay.tfar : FLT_MAX;
+		color = Lvolume(primaryRay, t_surface, color);
+	}
+	// Accumulate the obtained radiance to the pixels color
+	accumulateSample(pixel, color);
+	return isPixelActive(x, y);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Trace one path per (active) pixel of a tile, one primary ray at a
+/// time. Returns the number of pixels that still need more samples.
+///////////////////////////////////////////////////////////////////////////
+static int traceTile(const Tile& tile, const vec3& camera_pos, const mat4& inverse_PV)
+{
+	int active_pixels = 0;
+	for(int y = tile.y0; y < tile.y1; y++)
+	{
+		for(int x = tile.x0; x < tile.x1; x++)
+		{
+			if(!isPixelActive(x, y))
+			{
+				continue;
+			}
+			Ray primaryRay = generatePrimaryRay(x, y, camera_pos, inverse_PV);
+			intersect(primaryRay);
+			active_pixels += shadePixel(x, y, primaryRay) ? 1 : 0;
+		}
+	}
+	return active_pixels;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Trace one path per (active) pixel of a tile, with the primary rays of
+/// small blocks of pixels (e.g. 4x2 for packets of 8, 4x4 for 16) traced
+/// together as one coherent packet. Returns the number of pixels that
+/// still need more samples.
+///////////////////////////////////////////////////////////////////////////
+static int traceTilePackets(const Tile& tile,
+                            int packet_size,
+                            const vec3& camera_pos,
+                            const mat4& inverse_PV)
+{
+	const int block_width = std::min(packet_size, 4);
+	const int block_height = std::max(packet_size / block_width, 1);
+	Ray rays[MAX_RAY_PACKET_SIZE];
+	ivec2 pixels[MAX_RAY_PACKET_SIZE];
+	int active_pixels = 0;
+	for(int by = tile.y0; by < tile.y1; by += block_height)
+	{
+		for(int bx = tile.x0; bx < tile.x1; bx += block_width)
+		{
+			int count = 0;
+			for(int y = by; y < std::min(by + block_height, tile.y1); y++)
+			{
+				for(int x = bx; x < std::min(bx + block_width, tile.x1); x++)
+				{
+					if(!isPixelActive(x, y))
+					{
+						continue;
+					}
+					pixels[count] = ivec2(x, y);
+					rays[count] = generatePrimaryRay(x, y, camera_pos, inverse_PV);
+					count++;
+				}
+			}
+			if(count == 0)
+			{
+				continue;
+			}
+			intersect(rays, count);
+			for(int i = 0; i < count; i++)
+			{
+				active_pixels += shadePixel(pixels[i].x, pixels[i].y, rays[i]) ? 1 : 0;
+			}
+		}
+	}
+	return active_pixels;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 /// Trace one path per pixel and accumulate the result in an image
 ///////////////////////////////////////////////////////////////////////////
@@ -117,46 +382,66 @@ void tracePaths(const glm::mat4& V, const glm::mat4& P)
 	{
 		return;
 	}
+	// ...or if adaptive sampling has converged everywhere
+	if(settings.adaptive_sampling && rendered_image.number_of_samples > 0
+	   && rendered_image.number_of_active_pixels == 0)
+	{
+		return;
+	}
+	PROFILE_SCOPE("Trace paths");
 	vec3 camera_pos = vec3(glm::inverse(V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
-	// Trace one path per pixel (the omp parallel stuf magically distributes the
-	// pathtracing on all cores of your CPU).
-	int num_rays = 0;
-	vector<vec4> local_image(rendered_image.width * rendered_image.height, vec4(0.0f));
+	mat4 inverse_PV = inverse(P * V);
+	const int center_x = rendered_image.width / 2, center_y = rendered_image.height / 2;
+	const vec3 center_d = generatePrimaryRay(center_x, center_y, camera_pos, inverse_PV).d;
+	const vec3 neighbour_d = generatePrimaryRay(center_x, center_y + 1, camera_pos, inverse_PV).d;
+	pixel_spread_angle = acos(std::min(dot(center_d, neighbour_d), 1.0f));
+
+	if(settings.wavefront)
+	{
+		rendered_image.number_of_active_pixels = traceWavefront(camera_pos, inverse_PV);
+		rendered_image.number_of_samples += 1;
+		return;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Split the image into tiles (only when the image or tile size has
+	// changed) and hand them out to the threads.
+	///////////////////////////////////////////////////////////////////////
+	static vector<Tile> tiles;
+	static int tiles_width = -1, tiles_height = -1, tiles_size = -1;
+	if(tiles_width != rendered_image.width || tiles_height != rendered_image.height
+	   || tiles_size != settings.tile_size)
+	{
+		tiles = createTiles(rendered_image.width, rendered_image.height, settings.tile_size);
+		tiles_width = rendered_image.width;
+		tiles_height = rendered_image.height;
+		tiles_size = settings.tile_size;
+	}
+	static TileScheduler scheduler;
+	scheduler.reset(tiles, omp_get_max_threads());
+	const int packet_size = std::min(settings.ray_packet_size, MAX_RAY_PACKET_SIZE);
 
-#pragma omp parallel for
-	for(int y = 0; y < rendered_image.height; y++)
+	// Trace one path per pixel. Every thread renders its own tiles and
+	// steals tiles from the other threads when it runs out.
+	int active_pixels = 0;
+#pragma omp parallel reduction(+ : active_pixels)
 	{
-		for(int x = 0; x < rendered_image.width; x++)
+		PROFILE_SCOPE("Trace tiles");
+		const int thread_id = omp_get_thread_num();
+		Tile tile;
+		while(scheduler.next(thread_id, tile))
 		{
-			vec3 color;
-			Ray primaryRay;
-			primaryRay.o = camera_pos;
-			// Create a ray that starts in the camera position and points toward
-			// the current pixel on a virtual screen.
-			vec2 screenCoord = vec2(float(x) / float(rendered_image.width),
-			                        float(y) / float(rendered_image.height));
-			// Calculate direction
-			vec4 viewCoord = vec4(screenCoord.x * 2.0f - 1.0f, screenCoord.y * 2.0f - 1.0f, 1.0f, 1.0f);
-			vec3 p = homogenize(inverse(P * V) * viewCoord);
-			primaryRay.d = normalize(p - camera_pos);
-			// Intersect ray with scene
-			if(intersect(primaryRay))
+			if(packet_size > 1)
 			{
-				// If it hit something, evaluate the radiance from that point
-				color = Li(primaryRay);
+				active_pixels += traceTilePackets(tile, packet_size, camera_pos, inverse_PV);
 			}
 			else
 			{
-				// Otherwise evaluate environment
-				color = Lenvironment(primaryRay.d);
+				active_pixels += traceTile(tile, camera_pos, inverse_PV);
 			}
-			// Accumulate the obtained radiance to the pixels color
-			float n = float(rendered_image.number_of_samples);
-			rendered_image.data[y * rendered_image.width + x] =
-			    rendered_image.data[y * rendered_image.width + x] * (n / (n + 1.0f))
-			    + (1.0f / (n + 1.0f)) * color;
 		}
 	}
+	rendered_image.number_of_active_pixels = active_pixels;
 	rendered_image.number_of_samples += 1;
 }
 }; // namespace pathtracer
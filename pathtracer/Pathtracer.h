@@ -4,6 +4,9 @@
 #include <Model.h>
 #include <omp.h>
 #include "HDRImage.h"
+#include "sampling.h"
+#include "envmap.h"
+#include "lights.h"
 
 #ifdef M_PI
 #undef M_PI
@@ -26,6 +29,34 @@ extern struct Settings
 	int subsampling;
 	int max_bounces;
 	int max_paths_per_pixel;
+	// Width and height (in pixels) of the tiles that are distributed over
+	// the threads
+	int tile_size;
+	// Number of primary rays traced together as one Embree packet
+	// (1 = trace single rays)
+	int ray_packet_size;
+	// Trace with the wavefront integrator (see wavefront.h) rather than one
+	// path at a time per tile. It keeps up to `wavefront_queue_size` paths
+	// in flight, and each stage hands them to the threads in batches of
+	// `wavefront_batch_size`.
+	bool wavefront;
+	int wavefront_queue_size;
+	int wavefront_batch_size;
+	// Adaptive sampling: after `adaptive_min_samples` samples, a pixel
+	// stops receiving samples once the relative standard error of its
+	// mean luminance drops below `adaptive_error_threshold`. Rendering
+	// stops when all pixels have converged (or max_paths_per_pixel is
+	// reached, if non-zero).
+	bool adaptive_sampling;
+	float adaptive_error_threshold;
+	int adaptive_min_samples;
+	// The sample sequence used by randf()
+	SamplerType sampler;
+	// Light surfaces by the environment with directions sampled from the
+	// environment map (true) or from the BRDF (false)
+	bool environment_importance_sampling;
+	// How the light sampled for direct illumination is chosen
+	LightSelection light_selection;
 };
 extern Settings settings;
 
@@ -36,6 +67,8 @@ extern struct Environment
 {
 	float multiplier;
 	HDRImage map;
+	// For importance sampling the map, built when the map is loaded
+	EnvironmentDistribution distribution;
 };
 extern Environment environment;
 
@@ -45,7 +78,17 @@ extern Environment environment;
 extern struct Image
 {
 	int width, height, number_of_samples = 0;
+	// Pixels that had not converged after the last pass (adaptive sampling)
+	int number_of_active_pixels = 0;
 	std::vector<glm::vec3> data;
+	// Per pixel sample count, and running sum of squared deviations from
+	// the mean luminance (Welford). Variance = m2 / (samples - 1).
+	std::vector<int> pixel_samples;
+	std::vector<float> luminance_m2;
+	float getVariance(int pixel) const
+	{
+		return pixel_samples[pixel] > 1 ? luminance_m2[pixel] / float(pixel_samples[pixel] - 1) : 0.0f;
+	}
 	float* getPtr()
 	{
 		return &data[0].x;
@@ -7,7 +7,37 @@ layout(location = 0) out vec4 fragmentColor;
 layout(binding = 0) uniform sampler2D image;
 in vec2 texCoord;
 
+// Same settings and curves as labhelper::toneMapImage(), so the display
+// matches the PNG files
+uniform float exposure = 1.0;
+// 0: clamp, 1: Reinhard, 2: ACES
+uniform int tone_operator = 0;
+uniform bool srgb = false;
+
+vec3 srgbEncode(vec3 c)
+{
+	return mix(12.92 * c, 1.055 * pow(c, vec3(1.0 / 2.4)) - 0.055, greaterThan(c, vec3(0.0031308)));
+}
+
 void main()
 {
-	fragmentColor = texture(image, texCoord);
+	// The image is linear HDR radiance
+	vec3 x = max(texture(image, texCoord).rgb * exposure, vec3(0.0));
+	if(tone_operator == 1)
+	{
+		x = x / (x + 1.0);
+	}
+	else if(tone_operator == 2)
+	{
+		x = min((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), vec3(1.0));
+	}
+	else
+	{
+		x = min(x, vec3(1.0));
+	}
+	if(srgb)
+	{
+		x = srgbEncode(x);
+	}
+	fragmentColor = vec4(x, 1.0);
 }
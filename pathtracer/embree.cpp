@@ -1,6 +1,11 @@
 #include "embree.h"
+#include "material.h"
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
 #include <map>
+#include <omp.h>
 
 
 using namespace std;
@@ -13,16 +18,12 @@ namespace pathtracer
 ///////////////////////////////////////////////////////////////////////////
 RTCDevice embree_device = nullptr;
 RTCScene embree_scene = nullptr;
-
-///////////////////////////////////////////////////////////////////////////
-// Build an acceleration structure for the scene
-///////////////////////////////////////////////////////////////////////////
-void buildBVH()
-{
-	cout << "Embree building BVH..." << flush;
-	rtcCommit(embree_scene);
-	cout << "done.\n";
-}
+// The RTC_INTERSECTx flags supported by the device (and set on the scene)
+int embree_intersect_flags = RTC_INTERSECT1;
+// Whether models can be moved and removed after the BVH has been built
+bool embree_scene_dynamic = false;
+// Whether Embree reads the positions and indices of models in place
+bool embree_share_model_buffers = false;
 
 ///////////////////////////////////////////////////////////////////////////
 // Called when there is an embree error
@@ -34,10 +35,97 @@ void embreeErrorHandler(void* userval, const RTCError code, const char* str)
 }
 
 ///////////////////////////////////////////////////////////////////////////
-// Used to map an Embree geometry ID to our scene Meshes and Materials
+// Used to map an Embree geometry ID (within a prototype, see below) to our
+// scene Meshes and Materials. Embree hands out geometry IDs densely from
+// 0, so the records are stored in a flat array indexed directly by
+// geomID. Each record caches everything getIntersection() needs, so a hit
+// only touches one record (and its instance).
 ///////////////////////////////////////////////////////////////////////////
-map<uint32_t, const labhelper::Model*> map_geom_ID_to_model;
-map<uint32_t, const labhelper::Mesh*> map_geom_ID_to_mesh;
+struct GeometryRecord
+{
+	const labhelper::Model* model;
+	const labhelper::Mesh* mesh;
+	const labhelper::Material* material;
+	uint32_t material_idx;
+	CompiledMaterial compiled_material;
+	// The mesh's indices. Triangle `primID` uses indices primID * 3 + [0, 1, 2]
+	const uint32_t* indices;
+	// The mesh's first vertex normal and texture coordinate, which the
+	// indices are relative to.
+	const vec3* normals;
+	const vec2* texture_coordinates;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Each model is added to Embree once, untransformed, as a prototype scene
+// with one geometry per mesh. Every placement of the model is an instance
+// of its prototype in the top level scene, so a model that is placed many
+// times is only stored, and its BVH only built, once. A prototype is
+// released once its last instance has been removed.
+///////////////////////////////////////////////////////////////////////////
+struct Prototype
+{
+	RTCScene scene = nullptr;
+	bool committed = false;
+	int instance_count = 0;
+	vector<GeometryRecord> records;
+};
+// std::map, so that the records of a prototype never move
+map<const labhelper::Model*, Prototype> prototypes;
+
+///////////////////////////////////////////////////////////////////////////
+// The placements, indexed by instance ID (the geometry ID of the instance
+// in the top level scene). Embree returns hits on instances in world
+// space, except for the geometry normal, which is in model space.
+///////////////////////////////////////////////////////////////////////////
+struct InstanceRecord
+{
+	const labhelper::Model* model;
+	// nullptr if the instance has been removed
+	const GeometryRecord* records;
+	// Transform normals to world space: the inverse transpose for the
+	// vertex normals, and the cofactor matrix for the geometry normal,
+	// which keeps its length equal to twice the triangle's area.
+	mat3 normal_matrix;
+	mat3 cofactor_matrix;
+};
+vector<InstanceRecord> instance_records;
+
+///////////////////////////////////////////////////////////////////////////
+// Ray counts per OpenMP thread, each on its own cache line so that the
+// threads don't contend for it.
+///////////////////////////////////////////////////////////////////////////
+struct alignas(64) ThreadRayCounts
+{
+	uint64_t intersect = 0;
+	uint64_t occluded = 0;
+};
+const int max_counted_threads = 256;
+static ThreadRayCounts thread_ray_counts[max_counted_threads];
+
+static ThreadRayCounts& rayCounts()
+{
+	return thread_ray_counts[omp_get_thread_num() % max_counted_threads];
+}
+
+RayCounts getRayCounts()
+{
+	RayCounts counts = { 0, 0 };
+	for(const ThreadRayCounts& c : thread_ray_counts)
+	{
+		counts.intersect += c.intersect;
+		counts.occluded += c.occluded;
+	}
+	return counts;
+}
+
+void resetRayCounts()
+{
+	for(ThreadRayCounts& c : thread_ray_counts)
+	{
+		c = ThreadRayCounts();
+	}
+}
 
 void initEmbree()
 {
@@ -51,11 +139,17 @@ void initEmbree()
 		embree_is_initialized = true;
 		embree_device = rtcNewDevice();
 		rtcDeviceSetErrorFunction2(embree_device, embreeErrorHandler, nullptr);
+		if(rtcDeviceGetParameter1i(embree_device, RTC_CONFIG_INTERSECT4))
+			embree_intersect_flags |= RTC_INTERSECT4;
+		if(rtcDeviceGetParameter1i(embree_device, RTC_CONFIG_INTERSECT8))
+			embree_intersect_flags |= RTC_INTERSECT8;
+		if(rtcDeviceGetParameter1i(embree_device, RTC_CONFIG_INTERSECT16))
+			embree_intersect_flags |= RTC_INTERSECT16;
 		cout << "done.\n";
 	}
 }
 
-void reinitScene()
+void reinitScene(bool dynamic)
 {
 	initEmbree();
 
@@ -63,75 +157,279 @@ void reinitScene()
 	{
 		rtcDeleteScene(embree_scene);
 	}
+	for(auto& it : prototypes)
+	{
+		rtcDeleteScene(it.second.scene);
+	}
 
-	embree_scene = rtcDeviceNewScene(embree_device, RTC_SCENE_STATIC, RTC_INTERSECT1);
+	prototypes.clear();
+	instance_records.clear();
+	clearModelTextures();
+	embree_scene_dynamic = dynamic;
+	embree_scene = rtcDeviceNewScene(embree_device, dynamic ? RTC_SCENE_DYNAMIC : RTC_SCENE_STATIC,
+	                                 RTCAlgorithmFlags(embree_intersect_flags));
 }
 
 ///////////////////////////////////////////////////////////////////////////
-// Add a model to the embree scene
+// Recompile the materials of the scene
 ///////////////////////////////////////////////////////////////////////////
-void addModel(const labhelper::Model* model, const mat4& model_matrix)
+void updateMaterials()
 {
-	///////////////////////////////////////////////////////////////////////
-	// Lazy initialize embree on first use
-	///////////////////////////////////////////////////////////////////////
-	if(!embree_scene)
+	for(auto& it : prototypes)
 	{
-		reinitScene();
+		for(auto& record : it.second.records)
+		{
+			if(record.material != nullptr)
+			{
+				record.compiled_material = compileMaterial(*record.material);
+			}
+		}
 	}
+}
 
+///////////////////////////////////////////////////////////////////////////
+// Get the prototype of a model, creating it on first use
+///////////////////////////////////////////////////////////////////////////
+static Prototype& getPrototype(const labhelper::Model* model)
+{
+	Prototype& prototype = prototypes[model];
+	if(prototype.scene)
+	{
+		return prototype;
+	}
 	///////////////////////////////////////////////////////////////////////
-	// Transform and add each mesh in the model as a geometry in embree,
-	// and create mappings so that we can connect an embree geom_ID to a
-	// Material.
+	// Add each mesh in the model as a geometry in embree, and create
+	// mappings so that we can connect an embree geom_ID to a Material.
 	///////////////////////////////////////////////////////////////////////
-	cout << "Adding " << model->m_name << " to embree scene..." << flush;
+	// A compact scene keeps indices in its BVH rather than copies of the
+	// triangles, so that shared positions are not duplicated there either
+	const bool share_buffers = embree_share_model_buffers;
+	const int scene_flags = RTC_SCENE_STATIC | (share_buffers ? RTC_SCENE_COMPACT : 0);
+	prototype.scene = rtcDeviceNewScene(embree_device, RTCSceneFlags(scene_flags),
+	                                    RTCAlgorithmFlags(embree_intersect_flags));
 	for(auto& mesh : model->m_meshes)
 	{
-		uint32_t geom_ID = rtcNewTriangleMesh(embree_scene, RTC_GEOMETRY_STATIC,
-		                                      mesh.m_number_of_vertices / 3, mesh.m_number_of_vertices);
-		map_geom_ID_to_mesh[geom_ID] = &mesh;
-		map_geom_ID_to_model[geom_ID] = model;
-		// Transform and commit vertices
-		vec4* embree_vertices = (vec4*)rtcMapBuffer(embree_scene, geom_ID, RTC_VERTEX_BUFFER);
+		uint32_t geom_ID = rtcNewTriangleMesh(prototype.scene, RTC_GEOMETRY_STATIC,
+		                                      mesh.m_number_of_indices / 3, mesh.m_number_of_vertices);
+		if(prototype.records.size() <= geom_ID)
+		{
+			prototype.records.resize(geom_ID + 1);
+		}
+		GeometryRecord& record = prototype.records[geom_ID];
+		record.model = model;
+		record.mesh = &mesh;
+		record.material_idx = mesh.m_material_idx;
+		record.material = &model->m_materials[mesh.m_material_idx];
+		record.compiled_material = compileMaterial(*record.material);
+		record.indices = model->m_indices.data() + mesh.m_start_index;
+		record.normals = model->m_normals.data() + mesh.m_base_vertex;
+		record.texture_coordinates = model->m_texture_coordinates.data() + mesh.m_base_vertex;
+		if(share_buffers)
+		{
+			// The positions are read with 16 byte loads, which the padding
+			// element of Model::m_positions allows for the last one
+			rtcSetBuffer2(prototype.scene, geom_ID, RTC_VERTEX_BUFFER,
+			              model->m_positions.data() + mesh.m_base_vertex, 0, sizeof(vec3),
+			              mesh.m_number_of_vertices);
+			rtcSetBuffer2(prototype.scene, geom_ID, RTC_INDEX_BUFFER, record.indices, 0, 3 * sizeof(uint32_t),
+			              mesh.m_number_of_indices / 3);
+			continue;
+		}
+		// Commit vertices
+		vec4* embree_vertices = (vec4*)rtcMapBuffer(prototype.scene, geom_ID, RTC_VERTEX_BUFFER);
 		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
 		{
-			embree_vertices[i] = model_matrix * vec4(model->m_positions[mesh.m_start_index + i], 1.0f);
+			embree_vertices[i] = vec4(model->m_positions[mesh.m_base_vertex + i], 1.0f);
 		}
-		rtcUnmapBuffer(embree_scene, geom_ID, RTC_VERTEX_BUFFER);
+		rtcUnmapBuffer(prototype.scene, geom_ID, RTC_VERTEX_BUFFER);
 		// Commit triangle indices
-		int* embree_tri_idxs = (int*)rtcMapBuffer(embree_scene, geom_ID, RTC_INDEX_BUFFER);
-		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
+		uint32_t* embree_tri_idxs = (uint32_t*)rtcMapBuffer(prototype.scene, geom_ID, RTC_INDEX_BUFFER);
+		memcpy(embree_tri_idxs, record.indices, mesh.m_number_of_indices * sizeof(uint32_t));
+		rtcUnmapBuffer(prototype.scene, geom_ID, RTC_INDEX_BUFFER);
+	}
+	return prototype;
+}
+
+void setShareModelBuffers(bool share)
+{
+	embree_share_model_buffers = share;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Build the BVHs of the prototypes that have been added since the last
+// time, which the instances in the top level scene refer to
+///////////////////////////////////////////////////////////////////////////
+static void commitPrototypes()
+{
+	for(auto& it : prototypes)
+	{
+		if(!it.second.committed)
 		{
-			embree_tri_idxs[i] = i;
+			rtcCommit(it.second.scene);
+			it.second.committed = true;
 		}
-		rtcUnmapBuffer(embree_scene, geom_ID, RTC_INDEX_BUFFER);
 	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Delete the prototypes that no instance refers to anymore. Removed
+// instances are only deleted from the top level scene when it is
+// committed, so this must come after that.
+///////////////////////////////////////////////////////////////////////////
+static void releaseUnusedPrototypes()
+{
+	for(auto it = prototypes.begin(); it != prototypes.end();)
+	{
+		if(it->second.instance_count == 0)
+		{
+			rtcDeleteScene(it->second.scene);
+			it = prototypes.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Build an acceleration structure for the scene
+///////////////////////////////////////////////////////////////////////////
+void buildBVH()
+{
+	cout << "Embree building BVH..." << flush;
+	updateBVH();
 	cout << "done.\n";
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Build the BVHs of new models, and the top level BVH over the instances.
+// In a dynamic scene, only the instances that have been added, moved or
+// removed since the last commit are updated.
+///////////////////////////////////////////////////////////////////////////
+void updateBVH()
+{
+	commitPrototypes();
+	rtcCommit(embree_scene);
+	releaseUnusedPrototypes();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Set the transform of an instance, and the matrices that take its hits
+// to world space
+///////////////////////////////////////////////////////////////////////////
+static void setInstanceTransform(uint32_t inst_ID, const mat4& model_matrix)
+{
+	rtcSetTransform2(embree_scene, inst_ID, RTC_MATRIX_COLUMN_MAJOR_ALIGNED16, &model_matrix[0].x);
+	InstanceRecord& instance = instance_records[inst_ID];
+	const mat3 m = mat3(model_matrix);
+	instance.normal_matrix = transpose(inverse(m));
+	instance.cofactor_matrix = determinant(m) * instance.normal_matrix;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Can the instance be edited?
+///////////////////////////////////////////////////////////////////////////
+static bool isEditable(uint32_t inst_ID)
+{
+	if(!embree_scene_dynamic)
+	{
+		cout << "Models can only be moved or removed in a dynamic scene (see reinitScene()).\n";
+		return false;
+	}
+	if(inst_ID >= instance_records.size() || instance_records[inst_ID].records == nullptr)
+	{
+		cout << "There is no model instance " << inst_ID << " in the scene.\n";
+		return false;
+	}
+	return true;
+}
+
+void setModelTransform(uint32_t inst_ID, const mat4& model_matrix)
+{
+	if(!isEditable(inst_ID))
+	{
+		return;
+	}
+	setInstanceTransform(inst_ID, model_matrix);
+	rtcUpdate(embree_scene, inst_ID);
+}
+
+void removeModel(uint32_t inst_ID)
+{
+	if(!isEditable(inst_ID))
+	{
+		return;
+	}
+	rtcDeleteGeometry(embree_scene, inst_ID);
+	InstanceRecord& instance = instance_records[inst_ID];
+	prototypes[instance.model].instance_count--;
+	instance.records = nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Add a model to the embree scene
+///////////////////////////////////////////////////////////////////////////
+uint32_t addModel(const labhelper::Model* model, const mat4& model_matrix)
+{
+	///////////////////////////////////////////////////////////////////////
+	// Lazy initialize embree on first use
+	///////////////////////////////////////////////////////////////////////
+	if(!embree_scene)
+	{
+		reinitScene();
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Place an instance of the model's prototype with the model matrix
+	///////////////////////////////////////////////////////////////////////
+	cout << "Adding " << model->m_name << " to embree scene..." << flush;
+	Prototype& prototype = getPrototype(model);
+	prototype.instance_count++;
+	uint32_t inst_ID = rtcNewInstance2(embree_scene, prototype.scene);
+	if(instance_records.size() <= inst_ID)
+	{
+		instance_records.resize(inst_ID + 1);
+	}
+	instance_records[inst_ID].model = model;
+	instance_records[inst_ID].records = prototype.records.data();
+	setInstanceTransform(inst_ID, model_matrix);
+	cout << "done.\n";
+	return inst_ID;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Extract an intersection from an embree ray.
 ///////////////////////////////////////////////////////////////////////////
 Intersection getIntersection(const Ray& r)
 {
-	const labhelper::Model* model = map_geom_ID_to_model[r.geomID];
-	const labhelper::Mesh* mesh = map_geom_ID_to_mesh[r.geomID];
+	const InstanceRecord& instance = instance_records[r.instID];
+	const GeometryRecord& record = instance.records[r.geomID];
+	const uint32_t i0 = record.indices[r.primID * 3 + 0];
+	const uint32_t i1 = record.indices[r.primID * 3 + 1];
+	const uint32_t i2 = record.indices[r.primID * 3 + 2];
 	Intersection i;
-	i.material = &(model->m_materials[mesh->m_material_idx]);
-	vec3 n0 = model->m_normals[((mesh->m_start_index / 3) + r.primID) * 3 + 0];
-	vec3 n1 = model->m_normals[((mesh->m_start_index / 3) + r.primID) * 3 + 1];
-	vec3 n2 = model->m_normals[((mesh->m_start_index / 3) + r.primID) * 3 + 2];
+	i.material = record.material;
+	i.compiled_material = &record.compiled_material;
+	vec3 n0 = record.normals[i0];
+	vec3 n1 = record.normals[i1];
+	vec3 n2 = record.normals[i2];
 	float w = 1.0f - (r.u + r.v);
-	i.shading_normal = normalize(w * n0 + r.u * n1 + r.v * n2);
-	i.geometry_normal = -normalize(r.n);
+	i.shading_normal = normalize(instance.normal_matrix * (w * n0 + r.u * n1 + r.v * n2));
+	const vec3 ng = instance.cofactor_matrix * r.n;
+	i.geometry_normal = -normalize(ng);
 	i.position = r.o + r.tfar * r.d;
 	i.wo = normalize(-r.d);
 
-	vec2 uv0 = model->m_texture_coordinates[((mesh->m_start_index / 3) + r.primID) * 3 + 0];
-	vec2 uv1 = model->m_texture_coordinates[((mesh->m_start_index / 3) + r.primID) * 3 + 1];
-	vec2 uv2 = model->m_texture_coordinates[((mesh->m_start_index / 3) + r.primID) * 3 + 2];
+	vec2 uv0 = record.texture_coordinates[i0];
+	vec2 uv1 = record.texture_coordinates[i1];
+	vec2 uv2 = record.texture_coordinates[i2];
 	i.uv = w * uv0 + r.u * uv1 + r.v * uv2;
+	// Embree's geometry normal is not normalized; its length is twice the
+	// triangle's area, as is that of the cross product of the UV edges
+	const vec2 e1 = uv1 - uv0, e2 = uv2 - uv0;
+	const float world_area = length(ng);
+	i.uv_scale = world_area > 0.0f ? sqrt(abs(e1.x * e2.y - e1.y * e2.x) / world_area) : 0.0f;
 	return i;
 }
 
@@ -140,6 +438,7 @@ Intersection getIntersection(const Ray& r)
 ///////////////////////////////////////////////////////////////////////////
 bool intersect(Ray& r)
 {
+	rayCounts().intersect++;
 	rtcIntersect(embree_scene, *((RTCRay*)&r));
 	return r.geomID != RTC_INVALID_GEOMETRY_ID;
 }
@@ -150,7 +449,129 @@ bool intersect(Ray& r)
 ///////////////////////////////////////////////////////////////////////////
 bool occluded(Ray& r)
 {
+	rayCounts().occluded++;
 	rtcOccluded(embree_scene, *((RTCRay*)&r));
 	return r.geomID != RTC_INVALID_GEOMETRY_ID;
 }
+
+///////////////////////////////////////////////////////////////////////////
+// Copy rays into an Embree packet (SoA) and back again. Lanes past
+// `count` are marked invalid.
+///////////////////////////////////////////////////////////////////////////
+template<int N, typename RTCRayPacket>
+static void packRays(const Ray* rays, int count, RTCRayPacket& packet, int* valid)
+{
+	for(int i = 0; i < N; i++)
+	{
+		const Ray& r = rays[std::min(i, count - 1)];
+		valid[i] = i < count ? -1 : 0;
+		packet.orgx[i] = r.o.x;
+		packet.orgy[i] = r.o.y;
+		packet.orgz[i] = r.o.z;
+		packet.dirx[i] = r.d.x;
+		packet.diry[i] = r.d.y;
+		packet.dirz[i] = r.d.z;
+		packet.tnear[i] = r.tnear;
+		packet.tfar[i] = r.tfar;
+		packet.time[i] = r.time;
+		packet.mask[i] = r.mask;
+		packet.geomID[i] = RTC_INVALID_GEOMETRY_ID;
+		packet.primID[i] = RTC_INVALID_GEOMETRY_ID;
+		packet.instID[i] = RTC_INVALID_GEOMETRY_ID;
+	}
+}
+
+template<typename RTCRayPacket>
+static void unpackRays(const RTCRayPacket& packet, Ray* rays, int count)
+{
+	for(int i = 0; i < count; i++)
+	{
+		Ray& r = rays[i];
+		r.tfar = packet.tfar[i];
+		r.n = vec3(packet.Ngx[i], packet.Ngy[i], packet.Ngz[i]);
+		r.u = packet.u[i];
+		r.v = packet.v[i];
+		r.geomID = packet.geomID[i];
+		r.primID = packet.primID[i];
+		r.instID = packet.instID[i];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Find the closest intersection for a packet of rays
+///////////////////////////////////////////////////////////////////////////
+void intersect(Ray* rays, int count)
+{
+	alignas(64) int valid[16];
+	if(count <= 4 && (embree_intersect_flags & RTC_INTERSECT4))
+	{
+		RTCRay4 packet;
+		packRays<4>(rays, count, packet, valid);
+		rtcIntersect4(valid, embree_scene, packet);
+		rayCounts().intersect += count;
+		unpackRays(packet, rays, count);
+	}
+	else if(count <= 8 && (embree_intersect_flags & RTC_INTERSECT8))
+	{
+		RTCRay8 packet;
+		packRays<8>(rays, count, packet, valid);
+		rtcIntersect8(valid, embree_scene, packet);
+		rayCounts().intersect += count;
+		unpackRays(packet, rays, count);
+	}
+	else if(count <= 16 && (embree_intersect_flags & RTC_INTERSECT16))
+	{
+		RTCRay16 packet;
+		packRays<16>(rays, count, packet, valid);
+		rtcIntersect16(valid, embree_scene, packet);
+		rayCounts().intersect += count;
+		unpackRays(packet, rays, count);
+	}
+	else
+	{
+		for(int i = 0; i < count; i++)
+		{
+			intersect(rays[i]);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Test whether the rays of a packet are intersected by the scene
+///////////////////////////////////////////////////////////////////////////
+void occluded(Ray* rays, int count)
+{
+	alignas(64) int valid[16];
+	if(count <= 4 && (embree_intersect_flags & RTC_INTERSECT4))
+	{
+		RTCRay4 packet;
+		packRays<4>(rays, count, packet, valid);
+		rtcOccluded4(valid, embree_scene, packet);
+		rayCounts().occluded += count;
+		unpackRays(packet, rays, count);
+	}
+	else if(count <= 8 && (embree_intersect_flags & RTC_INTERSECT8))
+	{
+		RTCRay8 packet;
+		packRays<8>(rays, count, packet, valid);
+		rtcOccluded8(valid, embree_scene, packet);
+		rayCounts().occluded += count;
+		unpackRays(packet, rays, count);
+	}
+	else if(count <= 16 && (embree_intersect_flags & RTC_INTERSECT16))
+	{
+		RTCRay16 packet;
+		packRays<16>(rays, count, packet, valid);
+		rtcOccluded16(valid, embree_scene, packet);
+		rayCounts().occluded += count;
+		unpackRays(packet, rays, count);
+	}
+	else
+	{
+		for(int i = 0; i < count; i++)
+		{
+			occluded(rays[i]);
+		}
+	}
+}
 } // namespace pathtracer
\ No newline at end of file
@@ -2,11 +2,14 @@
 #include <embree2/rtcore.h>
 #include <embree2/rtcore_ray.h>
 #include "Model.h"
+#include "texture.h"
 #include <glm/glm.hpp>
 #include <map>
 
 namespace pathtracer
 {
+struct CompiledMaterial;
+
 ///////////////////////////////////////////////////////////////////////////
 // This struct describes an intersection, as extracted from the Embree
 // ray.
@@ -28,8 +31,14 @@ struct Intersection
 	// Interpolated UV coordinates between the 3 vertices of the triangle
 	glm::vec2 uv;
 
-	// Material information of the hit triangle
+	// Texture space length per world space length on the triangle (the
+	// square root of the ratio of their areas), for texture filtering
+	float uv_scale;
+
+	// Material information of the hit triangle, and that material
+	// compiled for rendering
 	const labhelper::Material* material;
+	const CompiledMaterial* compiled_material;
 };
 
 ///////////////////////////////////////////////////////////////////////////
@@ -86,16 +95,46 @@ struct RTCORE_ALIGN(16) Ray
 // Scene functions
 ///////////////////////////////////////////////////////////////////////////
 
-// Add a model to the embree scene
-void addModel(const labhelper::Model* model, const glm::mat4& model_matrix);
+// Add a model to the embree scene. The model's triangles are only added
+// the first time; every call places another instance of them. Returns
+// the ID of the instance.
+uint32_t addModel(const labhelper::Model* model, const glm::mat4& model_matrix);
 
 // Build an acceleration structure for the scene
 void buildBVH();
 
 ///////////////////////////////////////////////////////////////////////////
-// Reinitialize the scene
+// Reinitialize the scene. A static scene is built once, for the fastest
+// traversal. In a dynamic scene, models can also be moved and removed
+// (and added) after the BVH has been built: call updateBVH() after the
+// edits, which only rebuilds the top level BVH over the instances and
+// keeps the BVHs of the models.
+///////////////////////////////////////////////////////////////////////////
+void reinitScene(bool dynamic = false);
+
+// Edit an instance (as returned by addModel) of a dynamic scene. When the
+// last instance of a model is removed, its geometry is freed by the next
+// updateBVH().
+void setModelTransform(uint32_t instance, const glm::mat4& model_matrix);
+void removeModel(uint32_t instance);
+
+// Bring the BVH up to date after editing the scene
+void updateBVH();
+
+///////////////////////////////////////////////////////////////////////////
+// Opt in to sharing the vertex positions and indices of models with
+// Embree, instead of giving it copies. This saves the copies, and the
+// BVHs refer to the shared triangles instead of storing them (at some
+// cost in traversal speed). The models must not change or be freed while
+// they are in the scene. Applies to models added to the scene for the
+// first time after the call.
+///////////////////////////////////////////////////////////////////////////
+void setShareModelBuffers(bool share);
+
+///////////////////////////////////////////////////////////////////////////
+// Recompile the materials of the scene, after they have been edited
 ///////////////////////////////////////////////////////////////////////////
-void reinitScene();
+void updateMaterials();
 
 
 ///////////////////////////////////////////////////////////////////////////
@@ -114,4 +153,30 @@ Intersection getIntersection(const Ray& r);
 // (does not return an intersection, as it doesn't find the closest one)
 bool occluded(Ray& r);
 
+///////////////////////////////////////////////////////////////////////////
+// Ray packet functions. These trace `count` rays (at most
+// MAX_RAY_PACKET_SIZE) together using the smallest Embree packet
+// (rtcIntersect4/8/16) they fit in, and write the hit data back into
+// each ray, just like the single ray functions do. If the packet size is
+// not supported by Embree, the rays are traced one at a time.
+///////////////////////////////////////////////////////////////////////////
+#define MAX_RAY_PACKET_SIZE 16
+
+// Find the closest intersection of each ray
+void intersect(Ray* rays, int count);
+
+// Test whether each ray is intersected anywhere by the scene
+void occluded(Ray* rays, int count);
+
+///////////////////////////////////////////////////////////////////////////
+// Number of rays traced (by all threads) since the last resetRayCounts()
+///////////////////////////////////////////////////////////////////////////
+struct RayCounts
+{
+	uint64_t intersect;
+	uint64_t occluded;
+};
+RayCounts getRayCounts();
+void resetRayCounts();
+
 } // namespace pathtracer
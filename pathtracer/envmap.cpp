@@ -0,0 +1,100 @@
+#include "envmap.h"
+#include "Pathtracer.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Texel y covers theta in [pi * (1 - (y + 1) / height), pi * (1 - y / height)],
+// since the map is looked up with v = 1 - theta / pi.
+///////////////////////////////////////////////////////////////////////////
+static float texelTheta(float v)
+{
+	return M_PI * (1.0f - v);
+}
+
+void EnvironmentDistribution::build(HDRImage& map)
+{
+	width = map.width;
+	height = map.height;
+	std::vector<float> luminance(size_t(width) * height);
+	for(int i = 0; i < width * height; i++)
+	{
+		const float* texel = &map.data[size_t(i) * 3];
+		luminance[i] = std::max(0.2126f * texel[0] + 0.7152f * texel[1] + 0.0722f * texel[2], 0.0f);
+	}
+	row_texels.resize(height);
+	std::vector<float> row_weights(height);
+#pragma omp parallel for
+	for(int y = 0; y < height; y++)
+	{
+		const float sin_theta = sin(texelTheta((y + 0.5f) / float(height)));
+		std::vector<float> weights(width);
+		for(int x = 0; x < width; x++)
+		{
+			// The map is looked up bilinearly, so the radiance within a
+			// texel depends on its neighbours too. Using the brightest of
+			// them keeps the pdf nonzero wherever the radiance is.
+			float neighbourhood = 0.0f;
+			for(int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ny++)
+			{
+				for(int dx = -1; dx <= 1; dx++)
+				{
+					const int nx = (x + dx + width) % width;
+					neighbourhood = std::max(neighbourhood, luminance[size_t(ny) * width + nx]);
+				}
+			}
+			weights[x] = neighbourhood * sin_theta;
+		}
+		row_texels[y].build(weights.data(), width);
+		row_weights[y] = float(row_texels[y].total_weight);
+	}
+	rows.build(row_weights.data(), height);
+}
+
+EnvironmentSample EnvironmentDistribution::sample(HDRImage& map, float multiplier) const
+{
+	const uint32_t y = rows.sample(randf());
+	const uint32_t x = row_texels[y].sample(randf());
+	const float u = (x + randf()) / float(width);
+	const float v = (y + randf()) / float(height);
+
+	const float phi = 2.0f * M_PI * u;
+	const float theta = texelTheta(v);
+	const float sin_theta = sin(theta);
+
+	EnvironmentSample sample;
+	sample.wi = vec3(sin_theta * cos(phi), cos(theta), sin_theta * sin(phi));
+	sample.L = multiplier * map.sample(u, v);
+	// The texel is chosen with probability pmf, and its position within
+	// the texel uniformly, which maps to a solid angle of
+	// (2 pi / width) * (pi / height) * sin(theta)
+	const float pmf = rows.pmf[y] * row_texels[y].pmf[x];
+	sample.pdf = 0.0f;
+	if(sin_theta > 0.0f)
+	{
+		sample.pdf = pmf * float(width) * float(height) / (2.0f * M_PI * M_PI * sin_theta);
+	}
+	return sample;
+}
+
+float EnvironmentDistribution::pdf(const vec3& wi) const
+{
+	const float theta = acos(std::max(-1.0f, std::min(1.0f, wi.y)));
+	float phi = atan(wi.z, wi.x);
+	if(phi < 0.0f)
+		phi = phi + 2.0f * M_PI;
+	const float sin_theta = sin(theta);
+	if(sin_theta <= 0.0f)
+	{
+		return 0.0f;
+	}
+	const int x = std::min(int(phi / (2.0f * M_PI) * width), width - 1);
+	const int y = std::min(int((1.0f - theta / M_PI) * height), height - 1);
+	const float pmf = rows.pmf[y] * row_texels[y].pmf[x];
+	return pmf * float(width) * float(height) / (2.0f * M_PI * M_PI * sin_theta);
+}
+} // namespace pathtracer
@@ -0,0 +1,46 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "HDRImage.h"
+#include "sampling.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// A direction sampled from the environment map, with the radiance from
+// that direction and the pdf (with respect to solid angle)
+///////////////////////////////////////////////////////////////////////////
+struct EnvironmentSample
+{
+	glm::vec3 wi;
+	glm::vec3 L;
+	float pdf;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Importance sampling of a latitude-longitude environment map. Texels
+// are chosen proportionally to their luminance (the largest in their 3x3
+// neighbourhood, as lookups are bilinear) times sin(theta) (their solid
+// angle): first a row from the marginal distribution, then a texel
+// from that row's conditional distribution. Both are alias tables, so
+// sampling and pdf evaluation are constant time.
+///////////////////////////////////////////////////////////////////////////
+struct EnvironmentDistribution
+{
+	int width = 0, height = 0;
+	AliasTable rows;
+	std::vector<AliasTable> row_texels;
+
+	// Build the distribution for `map`, which is looked up as in
+	// Lenvironment(). Must be called again if the map changes.
+	void build(HDRImage& map);
+
+	// Sample a direction (using two dimensions of randf() for the texel
+	// and two for the position within it). `multiplier` scales the
+	// returned radiance.
+	EnvironmentSample sample(HDRImage& map, float multiplier) const;
+
+	// The pdf of sample() returning direction wi
+	float pdf(const glm::vec3& wi) const;
+};
+} // namespace pathtracer
@@ -0,0 +1,71 @@
+#pragma once
+#include <glm/glm.hpp>
+#include "embree.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// The parts shared by the two integrators: Li() in Pathtracer.cpp, which
+// follows one path at a time, and the wavefront integrator in
+// wavefront.cpp, which advances a whole queue of paths one stage at a
+// time. Both consume the random numbers of a sample in the same order, so
+// they render the same image.
+///////////////////////////////////////////////////////////////////////////
+
+// The angle between the camera rays through neighbouring pixels, set by
+// tracePaths(). Lookups for camera rays filter textures over this angle.
+extern float pixel_spread_angle;
+
+///////////////////////////////////////////////////////////////////////////
+/// Return the radiance from a certain direction wi from the environment
+/// map, filtered over a cone of directions `spread` radians wide (or
+/// just bilinearly if it is 0).
+///////////////////////////////////////////////////////////////////////////
+glm::vec3 Lenvironment(const glm::vec3& wi, float spread = 0.0f);
+
+///////////////////////////////////////////////////////////////////////////
+/// Create a ray that starts in the camera position and points toward
+/// pixel (x, y) on a virtual screen.
+///////////////////////////////////////////////////////////////////////////
+Ray generatePrimaryRay(int x, int y, const glm::vec3& camera_pos, const glm::mat4& inverse_PV);
+
+///////////////////////////////////////////////////////////////////////////
+/// Adaptive sampling: does pixel (x, y) still need more samples?
+///////////////////////////////////////////////////////////////////////////
+bool isPixelActive(int x, int y);
+
+///////////////////////////////////////////////////////////////////////////
+/// Add the radiance `color` of one sample to the mean of a pixel, and
+/// update the running variance of its luminance
+///////////////////////////////////////////////////////////////////////////
+void accumulateSample(int pixel, const glm::vec3& color);
+
+///////////////////////////////////////////////////////////////////////////
+/// What happens at one vertex of a path. All radiances are relative to
+/// the throughput of the path up to the vertex.
+///////////////////////////////////////////////////////////////////////////
+#define MAX_SHADOW_RAYS 2
+struct PathVertex
+{
+	// Radiance emitted by the surface
+	glm::vec3 emitted = glm::vec3(0.0f);
+	// Shadow rays towards the sampled lights, and the radiance each one
+	// adds if it is not occluded
+	int shadow_count = 0;
+	Ray shadow_rays[MAX_SHADOW_RAYS];
+	glm::vec3 shadow_L[MAX_SHADOW_RAYS];
+	// Whether the path continues along `next_ray`, with its throughput
+	// multiplied by `weight`
+	bool scattered = false;
+	Ray next_ray;
+	glm::vec3 weight = glm::vec3(0.0f);
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Shade the hit point of `ray`, the `bounce`th surface along the path
+/// (0 for the camera ray). `path_length` is the distance along the path
+/// from the camera to the hit point, which sets the texture filter width.
+/// The random numbers are drawn from the calling thread's current sample.
+///////////////////////////////////////////////////////////////////////////
+PathVertex shadeVertex(const Ray& ray, float path_length, int bounce);
+} // namespace pathtracer
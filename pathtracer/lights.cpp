@@ -0,0 +1,565 @@
+#include "lights.h"
+#include "Pathtracer.h"
+#include <labhelper.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Bounds of a set of lights: a box around the emitters, a cone (axis,
+// theta_o) around their normals and how far from the normal they emit
+// light (theta_e). The angles are stored as cosines. Lights that emit in
+// all directions have theta_o = pi.
+///////////////////////////////////////////////////////////////////////////
+struct LightBounds
+{
+	vec3 bounds_min, bounds_max;
+	vec3 axis;
+	float cos_theta_o;
+	float cos_theta_e;
+	float power;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// A node of the light BVH. The first child of an interior node directly
+// follows it, and `index` is the second child. For a leaf, `index` is the
+// light.
+///////////////////////////////////////////////////////////////////////////
+struct LightNode
+{
+	LightBounds bounds;
+	uint32_t index;
+	bool is_leaf;
+};
+
+struct ModelInstance
+{
+	const labhelper::Model* model;
+	mat4 model_matrix;
+};
+
+static std::vector<ModelInstance> light_models;
+static std::vector<Light> lights;
+static AliasTable light_powers;
+static std::vector<LightNode> light_tree;
+
+static float luminance(const vec3& c)
+{
+	return dot(c, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+static float safeSqrt(float x)
+{
+	return sqrt(std::max(0.0f, x));
+}
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines
+static float cosSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+	return cos_a > cos_b ? 1.0f : cos_a * cos_b + sin_a * sin_b;
+}
+
+static float sinSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+	return cos_a > cos_b ? 0.0f : sin_a * cos_b - cos_a * sin_b;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Bounds of a single light
+///////////////////////////////////////////////////////////////////////////
+static LightBounds lightBounds(const Light& light)
+{
+	LightBounds b;
+	b.cos_theta_e = 0.0f;
+	b.axis = light.normal;
+	b.cos_theta_o = 1.0f;
+	switch(light.type)
+	{
+	case LIGHT_POINT:
+		b.bounds_min = b.bounds_max = light.p0;
+		b.axis = vec3(0.0f, 1.0f, 0.0f);
+		b.cos_theta_o = -1.0f;
+		b.power = 4.0f * M_PI * luminance(light.emission);
+		break;
+	case LIGHT_DISC:
+	{
+		const vec3 extent = light.radius * sqrt(max(vec3(1.0f) - light.normal * light.normal, vec3(0.0f)));
+		b.bounds_min = light.p0 - extent;
+		b.bounds_max = light.p0 + extent;
+		b.power = M_PI * light.area * luminance(light.emission);
+		break;
+	}
+	case LIGHT_TRIANGLE:
+		b.bounds_min = min(light.p0, min(light.p1, light.p2));
+		b.bounds_max = max(light.p0, max(light.p1, light.p2));
+		b.power = M_PI * light.area * luminance(light.emission);
+		break;
+	}
+	return b;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The smallest cone (of the kind used in LightBounds) containing a and b
+///////////////////////////////////////////////////////////////////////////
+static void unionCones(const vec3& axis_a, float cos_a, const vec3& axis_b, float cos_b, vec3& axis,
+                       float& cos_theta)
+{
+	const float theta_a = acos(clamp(cos_a, -1.0f, 1.0f));
+	const float theta_b = acos(clamp(cos_b, -1.0f, 1.0f));
+	const float theta_d = acos(clamp(dot(axis_a, axis_b), -1.0f, 1.0f));
+	if(std::min(theta_d + theta_b, M_PI) <= theta_a)
+	{
+		axis = axis_a;
+		cos_theta = cos_a;
+		return;
+	}
+	if(std::min(theta_d + theta_a, M_PI) <= theta_b)
+	{
+		axis = axis_b;
+		cos_theta = cos_b;
+		return;
+	}
+	const float theta_o = (theta_a + theta_d + theta_b) / 2.0f;
+	const vec3 rotation_axis = cross(axis_a, axis_b);
+	if(theta_o >= M_PI || dot(rotation_axis, rotation_axis) == 0.0f)
+	{
+		axis = axis_a;
+		cos_theta = -1.0f;
+		return;
+	}
+	// Rotate axis_a by theta_o - theta_a towards axis_b (Rodrigues)
+	const float theta_r = theta_o - theta_a;
+	const vec3 k = normalize(rotation_axis);
+	axis = normalize(axis_a * cos(theta_r) + cross(k, axis_a) * sin(theta_r));
+	cos_theta = cos(theta_o);
+}
+
+static LightBounds unionBounds(const LightBounds& a, const LightBounds& b)
+{
+	LightBounds u;
+	u.bounds_min = min(a.bounds_min, b.bounds_min);
+	u.bounds_max = max(a.bounds_max, b.bounds_max);
+	unionCones(a.axis, a.cos_theta_o, b.axis, b.cos_theta_o, u.axis, u.cos_theta_o);
+	u.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+	u.power = a.power + b.power;
+	return u;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Estimate of how much the lights in `b` contribute at p, with normal n:
+// their power, over the squared distance, times bounds on the cosines at
+// the lights and at p. This is the importance from Conty Estevez and
+// Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting"
+///////////////////////////////////////////////////////////////////////////
+static float importance(const LightBounds& b, const vec3& p, const vec3& n)
+{
+	const vec3 center = (b.bounds_min + b.bounds_max) * 0.5f;
+	const float diagonal = length(b.bounds_max - b.bounds_min);
+	// Keep the estimate finite close to (or inside) the bounds
+	const float d2 = std::max(dot(p - center, p - center), diagonal / 2.0f);
+
+	// Angle between the cone axis and the direction to p
+	const vec3 wi = d2 > 0.0f ? normalize(p - center) : vec3(0.0f, 1.0f, 0.0f);
+	const float cos_theta_w = dot(b.axis, wi);
+	const float sin_theta_w = safeSqrt(1.0f - cos_theta_w * cos_theta_w);
+
+	// Angle subtended by the bounds, as seen from p
+	float cos_theta_b = -1.0f;
+	const float radius2 = dot(b.bounds_max - center, b.bounds_max - center);
+	const float center_d2 = dot(p - center, p - center);
+	if(any(lessThan(p, b.bounds_min)) || any(greaterThan(p, b.bounds_max)))
+	{
+		if(center_d2 > radius2)
+		{
+			cos_theta_b = safeSqrt(1.0f - radius2 / center_d2);
+		}
+	}
+	const float sin_theta_b = safeSqrt(1.0f - cos_theta_b * cos_theta_b);
+
+	// The smallest angle between an emitter normal and the direction to p
+	const float sin_theta_o = safeSqrt(1.0f - b.cos_theta_o * b.cos_theta_o);
+	const float cos_theta_x = cosSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, b.cos_theta_o);
+	const float sin_theta_x = sinSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, b.cos_theta_o);
+	const float cos_theta_p = cosSubClamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+	if(cos_theta_p <= b.cos_theta_e)
+	{
+		return 0.0f;
+	}
+
+	// The smallest angle between n and the direction to the lights
+	const float cos_theta_i = std::abs(dot(wi, n));
+	const float sin_theta_i = safeSqrt(1.0f - cos_theta_i * cos_theta_i);
+	const float cos_theta_i_bound = cosSubClamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+
+	return std::max(b.power * cos_theta_p * cos_theta_i_bound / d2, 0.0f);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Cost of a node in the surface area orientation heuristic: power times
+// surface area times the solid angle the node emits into (measured as
+// the cosine-weighted M_omega of the paper). Thin boxes are penalized by
+// the ratio of the longest extent to the extent along the split axis.
+///////////////////////////////////////////////////////////////////////////
+static float splitCost(const LightBounds& b, int axis, const vec3& parent_extent)
+{
+	const float theta_o = acos(clamp(b.cos_theta_o, -1.0f, 1.0f));
+	const float theta_e = acos(clamp(b.cos_theta_e, -1.0f, 1.0f));
+	const float theta_w = std::min(theta_o + theta_e, M_PI);
+	const float sin_theta_o = sin(theta_o);
+	const float m_omega = 2.0f * M_PI * (1.0f - b.cos_theta_o)
+	                      + M_PI / 2.0f
+	                            * (2.0f * theta_w * sin_theta_o - cos(theta_o - 2.0f * theta_w)
+	                               - 2.0f * theta_o * sin_theta_o + b.cos_theta_o);
+	const vec3 d = b.bounds_max - b.bounds_min;
+	const float area = 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	const float max_extent = std::max(parent_extent.x, std::max(parent_extent.y, parent_extent.z));
+	const float k_r = parent_extent[axis] > 0.0f ? max_extent / parent_extent[axis] : 1.0f;
+	return b.power * m_omega * k_r * area;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Build the subtree over light_order[begin, end), in depth first order,
+// and return the index of its root. Splits are chosen among a few bins
+// of the light centroids along each axis.
+///////////////////////////////////////////////////////////////////////////
+static uint32_t buildLightTree(std::vector<uint32_t>& light_order,
+                               const std::vector<LightBounds>& bounds,
+                               size_t begin,
+                               size_t end)
+{
+	const uint32_t node_index = uint32_t(light_tree.size());
+	light_tree.push_back(LightNode());
+	if(end - begin == 1)
+	{
+		light_tree[node_index].bounds = bounds[light_order[begin]];
+		light_tree[node_index].index = light_order[begin];
+		light_tree[node_index].is_leaf = true;
+		return node_index;
+	}
+
+	LightBounds node_bounds = bounds[light_order[begin]];
+	vec3 centroid_min = (node_bounds.bounds_min + node_bounds.bounds_max) * 0.5f;
+	vec3 centroid_max = centroid_min;
+	for(size_t i = begin + 1; i < end; i++)
+	{
+		const LightBounds& b = bounds[light_order[i]];
+		node_bounds = unionBounds(node_bounds, b);
+		centroid_min = min(centroid_min, (b.bounds_min + b.bounds_max) * 0.5f);
+		centroid_max = max(centroid_max, (b.bounds_min + b.bounds_max) * 0.5f);
+	}
+
+	const int bin_count = 12;
+	float best_cost = FLT_MAX;
+	int best_axis = -1, best_split = 0;
+	const vec3 extent = node_bounds.bounds_max - node_bounds.bounds_min;
+	for(int axis = 0; axis < 3; axis++)
+	{
+		const float axis_min = centroid_min[axis];
+		const float axis_max = centroid_max[axis];
+		if(axis_max <= axis_min)
+		{
+			continue;
+		}
+		LightBounds bins[bin_count];
+		bool bin_used[bin_count] = {};
+		auto binOf = [&](const LightBounds& b) {
+			const float c = (b.bounds_min[axis] + b.bounds_max[axis]) * 0.5f;
+			return std::min(int(bin_count * (c - axis_min) / (axis_max - axis_min)), bin_count - 1);
+		};
+		for(size_t i = begin; i < end; i++)
+		{
+			const LightBounds& b = bounds[light_order[i]];
+			const int bin = binOf(b);
+			bins[bin] = bin_used[bin] ? unionBounds(bins[bin], b) : b;
+			bin_used[bin] = true;
+		}
+		for(int split = 1; split < bin_count; split++)
+		{
+			bool has_below = false, has_above = false;
+			LightBounds below, above;
+			for(int i = 0; i < split; i++)
+			{
+				if(bin_used[i])
+				{
+					below = has_below ? unionBounds(below, bins[i]) : bins[i];
+					has_below = true;
+				}
+			}
+			for(int i = split; i < bin_count; i++)
+			{
+				if(bin_used[i])
+				{
+					above = has_above ? unionBounds(above, bins[i]) : bins[i];
+					has_above = true;
+				}
+			}
+			if(!has_below || !has_above)
+			{
+				continue;
+			}
+			const float cost = splitCost(below, axis, extent) + splitCost(above, axis, extent);
+			if(cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_split = split;
+			}
+		}
+	}
+
+	size_t middle = (begin + end) / 2;
+	if(best_axis >= 0)
+	{
+		const float axis_min = centroid_min[best_axis];
+		const float axis_max = centroid_max[best_axis];
+		auto mid = std::partition(light_order.begin() + begin, light_order.begin() + end, [&](uint32_t l) {
+			const float c = (bounds[l].bounds_min[best_axis] + bounds[l].bounds_max[best_axis]) * 0.5f;
+			const int bin = std::min(int(bin_count * (c - axis_min) / (axis_max - axis_min)), bin_count - 1);
+			return bin < best_split;
+		});
+		middle = size_t(mid - light_order.begin());
+	}
+	// All centroids in the same place (or no split found), just halve the
+	// range.
+	if(middle == begin || middle == end)
+	{
+		middle = (begin + end) / 2;
+	}
+
+	buildLightTree(light_order, bounds, begin, middle);
+	const uint32_t second_child = buildLightTree(light_order, bounds, middle, end);
+	light_tree[node_index].bounds = node_bounds;
+	light_tree[node_index].index = second_child;
+	light_tree[node_index].is_leaf = false;
+	return node_index;
+}
+
+void clearModelLights()
+{
+	light_models.clear();
+}
+
+void addModelLights(const labhelper::Model* model, const mat4& model_matrix)
+{
+	light_models.push_back(ModelInstance{ model, model_matrix });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Append a light for every triangle of the model whose material emits.
+// The emitting side is the one the vertex normals point to.
+///////////////////////////////////////////////////////////////////////////
+static void gatherEmissiveTriangles(const ModelInstance& instance)
+{
+	const labhelper::Model* model = instance.model;
+	const mat3 normal_matrix = transpose(inverse(mat3(instance.model_matrix)));
+	for(auto& mesh : model->m_meshes)
+	{
+		const labhelper::Material& material = model->m_materials[mesh.m_material_idx];
+		if(luminance(material.m_emission) <= 0.0f)
+		{
+			continue;
+		}
+		const uint32_t* indices = model->m_indices.data() + mesh.m_start_index;
+		const vec3* positions = model->m_positions.data() + mesh.m_base_vertex;
+		const vec3* normals = model->m_normals.data() + mesh.m_base_vertex;
+		for(uint32_t i = 0; i < mesh.m_number_of_indices; i += 3)
+		{
+			Light light;
+			light.type = LIGHT_TRIANGLE;
+			light.emission = material.m_emission;
+			light.p0 = vec3(instance.model_matrix * vec4(positions[indices[i + 0]], 1.0f));
+			light.p1 = vec3(instance.model_matrix * vec4(positions[indices[i + 1]], 1.0f));
+			light.p2 = vec3(instance.model_matrix * vec4(positions[indices[i + 2]], 1.0f));
+			const vec3 n = cross(light.p1 - light.p0, light.p2 - light.p0);
+			light.area = 0.5f * length(n);
+			if(light.area <= 0.0f)
+			{
+				continue;
+			}
+			light.normal = normalize(n);
+			const vec3 vertex_normals =
+			    normal_matrix * (normals[indices[i]] + normals[indices[i + 1]] + normals[indices[i + 2]]);
+			if(dot(light.normal, vertex_normals) < 0.0f)
+			{
+				light.normal = -light.normal;
+			}
+			light.radius = 0.0f;
+			lights.push_back(light);
+		}
+	}
+}
+
+void buildLights()
+{
+	lights.clear();
+	if(luminance(point_light.color) * point_light.intensity_multiplier > 0.0f)
+	{
+		Light light;
+		light.type = LIGHT_POINT;
+		light.emission = point_light.intensity_multiplier * point_light.color;
+		light.p0 = point_light.position;
+		light.normal = vec3(0.0f);
+		light.radius = 0.0f;
+		light.area = 0.0f;
+		lights.push_back(light);
+	}
+	// A disc emits intensity_multiplier * color along its direction, i.e.
+	// it looks like the point light from far away (in front of it).
+	for(const DiscLight& disc : disc_lights)
+	{
+		Light light;
+		light.type = LIGHT_DISC;
+		light.p0 = disc.position;
+		light.normal = normalize(disc.direction);
+		light.radius = disc.radius;
+		light.area = M_PI * disc.radius * disc.radius;
+		if(light.area <= 0.0f || luminance(disc.color) * disc.intensity_multiplier <= 0.0f)
+		{
+			continue;
+		}
+		light.emission = disc.intensity_multiplier * disc.color / light.area;
+		lights.push_back(light);
+	}
+	for(const ModelInstance& instance : light_models)
+	{
+		gatherEmissiveTriangles(instance);
+	}
+
+	std::vector<LightBounds> bounds(lights.size());
+	std::vector<float> powers(lights.size());
+	std::vector<uint32_t> light_order(lights.size());
+	for(size_t i = 0; i < lights.size(); i++)
+	{
+		bounds[i] = lightBounds(lights[i]);
+		powers[i] = bounds[i].power;
+		light_order[i] = uint32_t(i);
+	}
+	light_powers.build(powers.data(), powers.size());
+	light_tree.clear();
+	if(!lights.empty())
+	{
+		light_tree.reserve(2 * lights.size() - 1);
+		buildLightTree(light_order, bounds, 0, lights.size());
+	}
+}
+
+size_t getLightCount()
+{
+	return lights.size();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Sample a point on `light` as seen from p, uniformly by area
+///////////////////////////////////////////////////////////////////////////
+static LightSample sampleLightSurface(const Light& light, const vec3& p, float u1, float u2)
+{
+	LightSample sample;
+	sample.pdf = 0.0f;
+	vec3 position;
+	switch(light.type)
+	{
+	case LIGHT_POINT:
+		sample.distance = length(light.p0 - p);
+		sample.wi = (light.p0 - p) / sample.distance;
+		sample.L = light.emission / (sample.distance * sample.distance);
+		sample.pdf = 1.0f;
+		return sample;
+	case LIGHT_DISC:
+	{
+		const mat3 tbn = labhelper::tangentSpace(light.normal);
+		const float r = light.radius * sqrt(u1);
+		const float phi = 2.0f * M_PI * u2;
+		position = light.p0 + r * cos(phi) * tbn[0] + r * sin(phi) * tbn[1];
+		break;
+	}
+	case LIGHT_TRIANGLE:
+	{
+		const float su = sqrt(u1);
+		const float b0 = 1.0f - su;
+		const float b1 = u2 * su;
+		position = b0 * light.p0 + b1 * light.p1 + (1.0f - b0 - b1) * light.p2;
+		break;
+	}
+	}
+	sample.distance = length(position - p);
+	if(sample.distance <= 0.0f)
+	{
+		return sample;
+	}
+	sample.wi = (position - p) / sample.distance;
+	const float cos_light = -dot(light.normal, sample.wi);
+	if(cos_light <= 0.0f)
+	{
+		return sample;
+	}
+	sample.L = light.emission;
+	// Convert the area pdf 1 / area to solid angle
+	sample.pdf = sample.distance * sample.distance / (light.area * cos_light);
+	return sample;
+}
+
+LightSample sampleLight(const vec3& p, const vec3& n, LightSelection selection)
+{
+	float u = randf();
+	const float u1 = randf();
+	const float u2 = randf();
+	LightSample none;
+	none.pdf = 0.0f;
+	if(lights.empty())
+	{
+		return none;
+	}
+
+	uint32_t light_index;
+	float pmf;
+	if(selection == LIGHT_SELECTION_POWER)
+	{
+		light_index = light_powers.sample(u);
+		pmf = light_powers.pmf[light_index];
+	}
+	else
+	{
+		// Walk down the tree, choosing each child proportionally to its
+		// importance and reusing the rescaled u for the next level.
+		const float one_minus_epsilon = 0.99999994f;
+		uint32_t node = 0;
+		pmf = 1.0f;
+		while(!light_tree[node].is_leaf)
+		{
+			const uint32_t child0 = node + 1;
+			const uint32_t child1 = light_tree[node].index;
+			const float importance0 = importance(light_tree[child0].bounds, p, n);
+			const float importance1 = importance(light_tree[child1].bounds, p, n);
+			if(importance0 == 0.0f && importance1 == 0.0f)
+			{
+				return none;
+			}
+			const float p0 = importance0 / (importance0 + importance1);
+			if(u < p0)
+			{
+				node = child0;
+				u = std::min(u / p0, one_minus_epsilon);
+				pmf *= p0;
+			}
+			else
+			{
+				node = child1;
+				u = std::min((u - p0) / (1.0f - p0), one_minus_epsilon);
+				pmf *= 1.0f - p0;
+			}
+		}
+		light_index = light_tree[node].index;
+	}
+	if(pmf <= 0.0f)
+	{
+		return none;
+	}
+	LightSample sample = sampleLightSurface(lights[light_index], p, u1, u2);
+	sample.pdf *= pmf;
+	return sample;
+}
+} // namespace pathtracer
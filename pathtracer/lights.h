@@ -0,0 +1,88 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "Model.h"
+#include "sampling.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// How the light to sample for direct illumination is chosen
+///////////////////////////////////////////////////////////////////////////
+enum LightSelection
+{
+	// Proportionally to the power of each light (alias table)
+	LIGHT_SELECTION_POWER = 0,
+	// Proportionally to the estimated contribution at the shading point,
+	// by walking down a light BVH
+	LIGHT_SELECTION_TREE = 1,
+};
+
+///////////////////////////////////////////////////////////////////////////
+// All light sources in the scene (the point light, the disc lights and
+// the emissive triangles) flattened into one list
+///////////////////////////////////////////////////////////////////////////
+enum LightType
+{
+	LIGHT_POINT,
+	LIGHT_DISC,
+	LIGHT_TRIANGLE,
+};
+
+struct Light
+{
+	LightType type;
+	// Intensity (point light) or emitted radiance (area lights)
+	glm::vec3 emission;
+	// Position (point light), center (disc) or first vertex (triangle)
+	glm::vec3 p0;
+	// The other two vertices of a triangle
+	glm::vec3 p1, p2;
+	// The side that emits light (area lights)
+	glm::vec3 normal;
+	float radius;
+	float area;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// A point sampled on a light, as seen from the shading point
+///////////////////////////////////////////////////////////////////////////
+struct LightSample
+{
+	// Direction and distance to the point on the light
+	glm::vec3 wi;
+	float distance;
+	// Incident radiance (or intensity / distance^2 for the point light)
+	glm::vec3 L;
+	// Probability of choosing this light, times the pdf (with respect to
+	// solid angle) of the point on it. 0 if nothing was sampled.
+	float pdf;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The models in the scene, whose triangles are lights if their material
+// has an emission. Forget them when the scene is reinitialized.
+///////////////////////////////////////////////////////////////////////////
+void clearModelLights();
+void addModelLights(const labhelper::Model* model, const glm::mat4& model_matrix);
+
+///////////////////////////////////////////////////////////////////////////
+// Gather point_light, disc_lights and the emissive triangles and build
+// the light selection structures. Must be called again whenever a light
+// (or the emission of a material) changes.
+///////////////////////////////////////////////////////////////////////////
+void buildLights();
+
+///////////////////////////////////////////////////////////////////////////
+// Number of lights in the last buildLights()
+///////////////////////////////////////////////////////////////////////////
+size_t getLightCount();
+
+///////////////////////////////////////////////////////////////////////////
+// Choose one light for the point p with normal n and sample a point on
+// it (using three dimensions of randf()). The cost is logarithmic in the
+// number of lights with LIGHT_SELECTION_TREE and constant with
+// LIGHT_SELECTION_POWER.
+///////////////////////////////////////////////////////////////////////////
+LightSample sampleLight(const glm::vec3& p, const glm::vec3& n, LightSelection selection);
+} // namespace pathtracer
@@ -1,18 +1,28 @@
 
 #include <GL/glew.h>
 #include <stb_image.h>
+#include <stb_image_write.h>
 #include <chrono>
+#include <memory>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <labhelper.h>
+#include <tonemap.h>
+#include <encoder.h>
+#include <profiler.h>
 #include <imgui.h>
 #include <imgui_impl_sdl_gl3.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <Model.h>
 #include <string>
 #include "Pathtracer.h"
 #include "embree.h"
 #include "sampling.h"
+#include "volume.h"
 
 
 using namespace glm;
@@ -29,12 +39,22 @@ static float deltaTime = 0.0f;
 
 bool showUI = true;
 
+// Running without a window or GL context (see runHeadless())
+bool g_headless = false;
+
 // Mouse input
 ivec2 g_prevMouseCoords = { -1, -1 };
 bool g_isMouseDragging = false;
 
 bool showLightSources = false;
 
+// Resolution of the volume density grid
+const int volume_grid_resolution = 64;
+
+// Conversion of the rendered image for display (in copyTexture.frag) and
+// to PNG
+labhelper::ToneMapSettings tone_map_settings;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Shader programs
 ///////////////////////////////////////////////////////////////////////////////
@@ -45,6 +65,15 @@ GLuint simpleShaderProgram;
 // GL texture to put pathtracing result into
 ///////////////////////////////////////////////////////////////////////////////
 uint32_t pathtracer_result_txt_id;
+int pathtracer_result_txt_width = 0, pathtracer_result_txt_height = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Two pixel buffer objects that the pathtraced image is streamed through.
+// While the GPU copies one into the texture, the next frame is written to
+// the other, so neither side waits for the other.
+///////////////////////////////////////////////////////////////////////////////
+GLuint pathtracer_result_pbos[2];
+int pathtracer_result_pbo_index = 0;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Scene
@@ -72,6 +101,10 @@ struct scene_t
 std::map<std::string, scene_t> scenes;
 std::string currentScene;
 camera_t camera;
+// The pathtracer's instance of each model in the current scene
+std::vector<uint32_t> scene_instances;
+// Models that have been removed from their scene, freed at exit
+std::vector<labhelper::Model*> removed_models;
 
 int selected_model_index = 0;
 int selected_mesh_index = 0;
@@ -80,9 +113,12 @@ int selected_material_index = 0;
 
 void loadScenes()
 {
+	// Models are only uploaded to the GPU when we have a GL context
+	const bool upload_to_gpu = !g_headless;
 	scenes["Sphere"] = { {
 		                     // Models
-		                     { labhelper::loadModelFromOBJ("../scenes/sphere.obj"), mat4(1.f) },
+		                     { labhelper::loadModelFromOBJ("../scenes/sphere.obj", upload_to_gpu),
+		                       mat4(1.f) },
 		                 },
 		                 {
 		                     // Camera
@@ -91,9 +127,10 @@ void loadScenes()
 		                 } };
 	scenes["Ship"] = { {
 		                   // Models
-		                   { labhelper::loadModelFromOBJ("../scenes/space-ship.obj"),
+		                   { labhelper::loadModelFromOBJ("../scenes/space-ship.obj", upload_to_gpu),
 		                     translate(vec3(0.f, 8.f, 0.f)) },
-		                   { labhelper::loadModelFromOBJ("../scenes/landingpad.obj"), mat4(1.f) },
+		                   { labhelper::loadModelFromOBJ("../scenes/landingpad.obj", upload_to_gpu),
+		                     mat4(1.f) },
 		               },
 		               {
 		                   // Camera
@@ -105,7 +142,8 @@ void loadScenes()
 
 	scenes["Refractions"] = { {
 		                          // Models
-		                          { labhelper::loadModelFromOBJ("../scenes/refractions.obj"), mat4(1.f) },
+		                          { labhelper::loadModelFromOBJ("../scenes/refractions.obj", upload_to_gpu),
+		                            mat4(1.f) },
 		                      },
 		                      {
 		                          // Camera
@@ -114,6 +152,19 @@ void loadScenes()
 		                      } };
 }
 
+// Time spent in the last changeScene(), per step
+struct SceneBuildTimes
+{
+	double add_models_seconds;
+	double bvh_build_seconds;
+	double light_build_seconds;
+} scene_build_times;
+
+static double secondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
 void changeScene(std::string sceneName)
 {
 	currentScene = sceneName;
@@ -124,18 +175,81 @@ void changeScene(std::string sceneName)
 	selected_material_index = scenes[currentScene].models[0].model->m_meshes[0].m_material_idx;
 
 
-	pathtracer::reinitScene();
+	// Models can be moved interactively, so only the headless renders get a
+	// static scene
+	pathtracer::reinitScene(!g_headless);
+	pathtracer::clearModelLights();
 
 	// Add models to pathtracer scene
+	auto start = std::chrono::high_resolution_clock::now();
+	scene_instances.clear();
 	for(auto& o : scenes[currentScene].models)
 	{
-		pathtracer::addModel(o.model, o.modelMat);
+		scene_instances.push_back(pathtracer::addModel(o.model, o.modelMat));
+		pathtracer::addModelLights(o.model, o.modelMat);
 	}
+	scene_build_times.add_models_seconds = secondsSince(start);
+	start = std::chrono::high_resolution_clock::now();
 	pathtracer::buildBVH();
+	scene_build_times.bvh_build_seconds = secondsSince(start);
+	start = std::chrono::high_resolution_clock::now();
+	pathtracer::buildLights();
+	scene_build_times.light_build_seconds = secondsSince(start);
 
 	pathtracer::restart();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Rebuild the lights of the current scene's models, if `model` emits light
+///////////////////////////////////////////////////////////////////////////////
+static void updateModelLights(const labhelper::Model* model)
+{
+	bool emissive = false;
+	for(auto& material : model->m_materials)
+	{
+		emissive |= material.m_emission != vec3(0.0f);
+	}
+	if(emissive)
+	{
+		pathtracer::clearModelLights();
+		for(auto& o : scenes[currentScene].models)
+		{
+			pathtracer::addModelLights(o.model, o.modelMat);
+		}
+		pathtracer::buildLights();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Move a model of the current scene. Only the top level of the
+// pathtracer's BVH is rebuilt, and the lights only if the model emits.
+///////////////////////////////////////////////////////////////////////////////
+void moveModel(int index, const mat4& model_matrix)
+{
+	scene_t& scene = scenes[currentScene];
+	scene.models[index].modelMat = model_matrix;
+	pathtracer::setModelTransform(scene_instances[index], model_matrix);
+	pathtracer::updateBVH();
+	updateModelLights(scene.models[index].model);
+	pathtracer::restart();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Remove a model from the current scene, like moveModel()
+///////////////////////////////////////////////////////////////////////////////
+void removeModel(int index)
+{
+	scene_t& scene = scenes[currentScene];
+	labhelper::Model* model = scene.models[index].model;
+	pathtracer::removeModel(scene_instances[index]);
+	pathtracer::updateBVH();
+	scene.models.erase(scene.models.begin() + index);
+	scene_instances.erase(scene_instances.begin() + index);
+	removed_models.push_back(model);
+	updateModelLights(model);
+	pathtracer::restart();
+}
+
 void cleanupScenes()
 {
 	for(auto& it : scenes)
@@ -145,38 +259,36 @@ void cleanupScenes()
 			labhelper::freeModel(m.model);
 		}
 	}
+	for(auto model : removed_models)
+	{
+		labhelper::freeModel(model);
+	}
+	removed_models.clear();
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////
-// Load shaders, environment maps, models and so on
+// Set up the path tracer settings, light sources, environment map and scenes.
+// Makes no GL calls, so it is shared by the windowed and headless modes.
 ///////////////////////////////////////////////////////////////////////////////
-void initialize()
+void initializePathtracer()
 {
-	///////////////////////////////////////////////////////////////////////////
-	// Load shader program
-	///////////////////////////////////////////////////////////////////////////
-	shaderProgram = labhelper::loadShaderProgram("../pathtracer/copyTexture.vert",
-	                                             "../pathtracer/copyTexture.frag");
-	simpleShaderProgram = labhelper::loadShaderProgram("../pathtracer/simple.vert",
-	                                                   "../pathtracer/simple.frag");
-
-	///////////////////////////////////////////////////////////////////////////
-	// Generate result texture
-	///////////////////////////////////////////////////////////////////////////
-	glGenTextures(1, &pathtracer_result_txt_id);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, pathtracer_result_txt_id);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
 	///////////////////////////////////////////////////////////////////////////
 	// Initial path-tracer settings
 	///////////////////////////////////////////////////////////////////////////
 	pathtracer::settings.max_bounces = 8;
 	pathtracer::settings.max_paths_per_pixel = 0; // 0 = Infinite
+	pathtracer::settings.tile_size = 16;
+	pathtracer::settings.ray_packet_size = 8;
+	pathtracer::settings.wavefront = false;
+	pathtracer::settings.wavefront_queue_size = 1 << 16;
+	pathtracer::settings.wavefront_batch_size = 256;
+	pathtracer::settings.adaptive_sampling = false;
+	pathtracer::settings.adaptive_error_threshold = 0.02f;
+	pathtracer::settings.adaptive_min_samples = 16;
+	pathtracer::settings.sampler = pathtracer::SAMPLER_SOBOL;
+	pathtracer::settings.environment_importance_sampling = true;
+	pathtracer::settings.light_selection = pathtracer::LIGHT_SELECTION_TREE;
 #ifdef _DEBUG
 	pathtracer::settings.subsampling = 16;
 #else
@@ -214,12 +326,50 @@ void initialize()
 	// Load environment map
 	///////////////////////////////////////////////////////////////////////////
 	pathtracer::environment.map.load("../scenes/envmaps/001.hdr");
+	pathtracer::environment.distribution.build(pathtracer::environment.map);
 	pathtracer::environment.multiplier = 1.0f;
 
+	///////////////////////////////////////////////////////////////////////////
+	// Volume (off by default), a sphere around the ship
+	///////////////////////////////////////////////////////////////////////////
+	pathtracer::volume.enabled = false;
+	pathtracer::volume.density_multiplier = 0.1f;
+	pathtracer::volume.albedo = vec3(0.9f);
+	pathtracer::volume.anisotropy = 0.0f;
+	pathtracer::createSphereVolume(vec3(0.0f, 8.0f, 0.0f), 12.0f, 0.0f, volume_grid_resolution);
+
 	///////////////////////////////////////////////////////////////////////////
 	// Load .obj models to scene
 	///////////////////////////////////////////////////////////////////////////
 	loadScenes();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load shaders, environment maps, models and so on
+///////////////////////////////////////////////////////////////////////////////
+void initialize()
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Load shader program
+	///////////////////////////////////////////////////////////////////////////
+	shaderProgram = labhelper::loadShaderProgram("../pathtracer/copyTexture.vert",
+	                                             "../pathtracer/copyTexture.frag");
+	simpleShaderProgram = labhelper::loadShaderProgram("../pathtracer/simple.vert",
+	                                                   "../pathtracer/simple.frag");
+
+	///////////////////////////////////////////////////////////////////////////
+	// Generate result texture
+	///////////////////////////////////////////////////////////////////////////
+	glGenTextures(1, &pathtracer_result_txt_id);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, pathtracer_result_txt_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glGenBuffers(2, pathtracer_result_pbos);
+
+	initializePathtracer();
 	changeScene("Ship");
 	//changeScene("Sphere");
 	//changeScene("Refractions");
@@ -232,6 +382,53 @@ void initialize()
 	//glEnable(GL_FRAMEBUFFER_SRGB);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Copy the pathtraced image to the result texture, as half floats (the
+// shader does the conversion for display). The texture and buffers are
+// only reallocated when the image size changes.
+///////////////////////////////////////////////////////////////////////////////
+void uploadRenderedImage()
+{
+	const int width = pathtracer::rendered_image.width;
+	const int height = pathtracer::rendered_image.height;
+	const GLsizeiptr size = GLsizeiptr(width) * height * sizeof(uint64_t);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, pathtracer_result_txt_id);
+	if(width != pathtracer_result_txt_width || height != pathtracer_result_txt_height)
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+		for(GLuint pbo : pathtracer_result_pbos)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		}
+		pathtracer_result_txt_width = width;
+		pathtracer_result_txt_height = height;
+	}
+
+	pathtracer_result_pbo_index = 1 - pathtracer_result_pbo_index;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pathtracer_result_pbos[pathtracer_result_pbo_index]);
+	// Invalidating lets the driver hand out fresh memory if the GPU is
+	// still reading the previous contents
+	uint64_t* pixels = (uint64_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+	                                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if(pixels)
+	{
+		const vec3* data = pathtracer::rendered_image.data.data();
+		const int pixel_count = width * height;
+#pragma omp parallel for
+		for(int i = 0; i < pixel_count; i++)
+		{
+			pixels[i] = glm::packHalf4x16(vec4(data[i], 1.0f));
+		}
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		// Sources the pixels from the bound buffer, so this returns before
+		// the copy is done
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_HALF_FLOAT, nullptr);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
 void display(void)
 {
 	{ ///////////////////////////////////////////////////////////////////////
@@ -263,14 +460,15 @@ void display(void)
 	///////////////////////////////////////////////////////////////////////////
 	// Copy pathtraced image to texture for display
 	///////////////////////////////////////////////////////////////////////////
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, pathtracer_result_txt_id);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, pathtracer::rendered_image.width,
-	             pathtracer::rendered_image.height, 0, GL_RGB, GL_FLOAT, pathtracer::rendered_image.getPtr());
+	{
+		PROFILE_GPU_SCOPE("Upload");
+		uploadRenderedImage();
+	}
 
 	///////////////////////////////////////////////////////////////////////////
 	// Render a fullscreen quad, textured with our pathtraced image.
 	///////////////////////////////////////////////////////////////////////////
+	PROFILE_GPU_SCOPE("Display");
 	glViewport(0, 0, windowWidth, windowHeight);
 	glClearColor(0.1f, 0.1f, 0.6f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -278,6 +476,9 @@ void display(void)
 	glEnable(GL_CULL_FACE);
 	SDL_GetWindowSize(g_window, &windowWidth, &windowHeight);
 	glUseProgram(shaderProgram);
+	labhelper::setUniformSlow(shaderProgram, "exposure", tone_map_settings.exposure);
+	labhelper::setUniformSlow(shaderProgram, "tone_operator", GLint(tone_map_settings.tone_operator));
+	labhelper::setUniformSlow(shaderProgram, "srgb", tone_map_settings.srgb);
 	labhelper::drawFullScreenQuad();
 
 	if(showLightSources)
@@ -476,11 +677,66 @@ void gui()
 		ImGui::SliderInt("Subsampling", &pathtracer::settings.subsampling, 1, 16);
 		ImGui::SliderInt("Max Bounces", &pathtracer::settings.max_bounces, 0, 16);
 		ImGui::SliderInt("Max Paths Per Pixel", &pathtracer::settings.max_paths_per_pixel, 0, 1024);
+		ImGui::SliderInt("Tile Size", &pathtracer::settings.tile_size, 4, 64);
+		static const int packet_sizes[] = { 1, 4, 8, 16 };
+		int packet_size_index = 0;
+		while(packet_size_index < 3 && packet_sizes[packet_size_index] < pathtracer::settings.ray_packet_size)
+		{
+			packet_size_index++;
+		}
+		if(ImGui::Combo("Ray Packets", &packet_size_index, "Single rays\0" "4\0" "8\0" "16\0"))
+		{
+			pathtracer::settings.ray_packet_size = packet_sizes[packet_size_index];
+		}
+		ImGui::Checkbox("Wavefront", &pathtracer::settings.wavefront);
+		if(pathtracer::settings.wavefront)
+		{
+			ImGui::SliderInt("Queue Size", &pathtracer::settings.wavefront_queue_size, 1024, 1 << 20);
+			ImGui::SliderInt("Batch Size", &pathtracer::settings.wavefront_batch_size, 16, 4096);
+		}
+		int sampler = pathtracer::settings.sampler;
+		if(ImGui::Combo("Sampler", &sampler, "Independent (PCG)\0" "Sobol (Owen scrambled)\0"))
+		{
+			pathtracer::settings.sampler = pathtracer::SamplerType(sampler);
+			pathtracer::restart();
+		}
+		int light_selection = pathtracer::settings.light_selection;
+		if(ImGui::Combo("Light Selection", &light_selection, "Power\0" "Light BVH\0"))
+		{
+			pathtracer::settings.light_selection = pathtracer::LightSelection(light_selection);
+			pathtracer::restart();
+		}
+		if(ImGui::Checkbox("Importance Sample Environment",
+		                   &pathtracer::settings.environment_importance_sampling))
+		{
+			pathtracer::restart();
+		}
+		if(ImGui::Checkbox("Adaptive Sampling", &pathtracer::settings.adaptive_sampling))
+		{
+			pathtracer::restart();
+		}
+		if(pathtracer::settings.adaptive_sampling)
+		{
+			ImGui::SliderFloat("Error Threshold", &pathtracer::settings.adaptive_error_threshold, 0.001f,
+			                   0.2f, "%.4f", 2.0f);
+			ImGui::SliderInt("Min Samples", &pathtracer::settings.adaptive_min_samples, 2, 256);
+		}
+		ImGui::SliderFloat("Exposure", &tone_map_settings.exposure, 0.0f, 16.0f, "%.3f", 2.0f);
+		int tone_operator = tone_map_settings.tone_operator;
+		if(ImGui::Combo("Tone Map", &tone_operator, "Clamp\0" "Reinhard\0" "ACES\0"))
+		{
+			tone_map_settings.tone_operator = labhelper::ToneMapOperator(tone_operator);
+		}
+		ImGui::Checkbox("sRGB Output", &tone_map_settings.srgb);
 		if(ImGui::Button("Restart Pathtracing"))
 		{
 			pathtracer::restart();
 		}
 		ImGui::Text("Num. samples: %d", pathtracer::getSampleCount());
+		if(pathtracer::settings.adaptive_sampling)
+		{
+			ImGui::Text("Active pixels: %d", pathtracer::rendered_image.number_of_active_pixels);
+		}
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -498,6 +754,23 @@ void gui()
 			selected_mesh_index = 0;
 			selected_material_index = selected_model->m_meshes[selected_mesh_index].m_material_idx;
 		}
+		const mat4& model_matrix = selected_scene->models[selected_model_index].modelMat;
+		vec3 position = vec3(model_matrix[3]);
+		if(ImGui::DragFloat3("Model Position", &position.x, 0.1f))
+		{
+			mat4 moved = model_matrix;
+			moved[3] = vec4(position, 1.0f);
+			moveModel(selected_model_index, moved);
+		}
+		// A scene always keeps at least one model
+		if(selected_scene->models.size() > 1 && ImGui::Button("Remove Model"))
+		{
+			removeModel(selected_model_index);
+			selected_model_index = std::min(selected_model_index, int(selected_scene->models.size()) - 1);
+			selected_model = selected_scene->models[selected_model_index].model;
+			selected_mesh_index = 0;
+			selected_material_index = selected_model->m_meshes[selected_mesh_index].m_material_idx;
+		}
 
 		///////////////////////////////////////////////////////////////////////////
 		// List all meshes in the model and show properties for the selected
@@ -522,13 +795,22 @@ void gui()
 		{
 			labhelper::Material& material = selected_model->m_materials[selected_material_index];
 			ImGui::LabelText("Material Name", "%s", material.m_name.c_str());
-			ImGui::ColorEdit3("Color", &material.m_color.x);
-			ImGui::SliderFloat("Metalness", &material.m_metalness, 0.0f, 1.0f);
-			ImGui::SliderFloat("Fresnel", &material.m_fresnel, 0.0f, 1.0f);
-			ImGui::SliderFloat("Shininess", &material.m_shininess, 0.0f, 5000.0f, "%.3f", 2);
-			ImGui::ColorEdit3("Emission", &material.m_emission.x);
-			ImGui::SliderFloat("Transparency", &material.m_transparency, 0.0f, 1.0f);
+			bool changed = ImGui::ColorEdit3("Color", &material.m_color.x);
+			changed |= ImGui::SliderFloat("Metalness", &material.m_metalness, 0.0f, 1.0f);
+			changed |= ImGui::SliderFloat("Fresnel", &material.m_fresnel, 0.0f, 1.0f);
+			changed |= ImGui::SliderFloat("Shininess", &material.m_shininess, 0.0f, 5000.0f, "%.3f", 2);
+			if(ImGui::ColorEdit3("Emission", &material.m_emission.x))
+			{
+				pathtracer::buildLights();
+				pathtracer::restart();
+				changed = true;
+			}
+			changed |= ImGui::SliderFloat("Transparency", &material.m_transparency, 0.0f, 1.0f);
 			//ImGui::SliderFloat("IoR", &material.m_ior, 0.1f, 3.0f);
+			if(changed)
+			{
+				pathtracer::updateMaterials();
+			}
 		}
 
 #if ALLOW_SAVE_MATERIALS
@@ -550,10 +832,10 @@ void gui()
 		ImGui::SliderFloat("Environment multiplier", &pathtracer::environment.multiplier, 0.0f, 10.0f);
 		ImGui::Separator();
 		ImGui::Text("Point Light");
-		ImGui::ColorEdit3("Point light color", &pathtracer::point_light.color.x);
-		ImGui::SliderFloat("Point light intensity multiplier", &pathtracer::point_light.intensity_multiplier,
-		                   0.0f, 10000.0f);
-		ImGui::DragFloat3("Position", &pathtracer::point_light.position.x, 0.1);
+		bool lights_changed = ImGui::ColorEdit3("Point light color", &pathtracer::point_light.color.x);
+		lights_changed |= ImGui::SliderFloat("Point light intensity multiplier",
+		                                     &pathtracer::point_light.intensity_multiplier, 0.0f, 10000.0f);
+		lights_changed |= ImGui::DragFloat3("Position", &pathtracer::point_light.position.x, 0.1);
 
 		for(int i = 0; i < pathtracer::disc_lights.size(); ++i)
 		{
@@ -561,27 +843,589 @@ void gui()
 			ImGui::Separator();
 			auto& l = pathtracer::disc_lights[i];
 			ImGui::Text("Disc Light %d", i);
-			ImGui::ColorEdit3("Color", &l.color.x);
-			ImGui::SliderFloat("Intensity", &l.intensity_multiplier, 0.0f, 10000.0f, "%.3f", 3);
-			ImGui::DragFloat3("Position", &l.position.x, 0.1);
+			lights_changed |= ImGui::ColorEdit3("Color", &l.color.x);
+			lights_changed |=
+			    ImGui::SliderFloat("Intensity", &l.intensity_multiplier, 0.0f, 10000.0f, "%.3f", 3);
+			lights_changed |= ImGui::DragFloat3("Position", &l.position.x, 0.1);
 
 			glm::vec2 dir(atan2(l.direction.z, l.direction.x) / (2 * M_PI) + 0.5, acos(l.direction.y) / M_PI);
-			ImGui::DragFloat2("Direction", &dir.x, 0.01, 0, 1);
-			dir.x -= 0.5;
-			dir.x *= 2 * M_PI;
-			dir.y *= M_PI;
-			l.direction = vec3(cos(dir.x) * sin(dir.y), cos(dir.y), sin(dir.x) * sin(dir.y));
+			if(ImGui::DragFloat2("Direction", &dir.x, 0.01, 0, 1))
+			{
+				dir.x -= 0.5;
+				dir.x *= 2 * M_PI;
+				dir.y *= M_PI;
+				l.direction = vec3(cos(dir.x) * sin(dir.y), cos(dir.y), sin(dir.x) * sin(dir.y));
+				lights_changed = true;
+			}
 
-			ImGui::DragFloat("Radius", &l.radius, 1, 0, 100);
+			lights_changed |= ImGui::DragFloat("Radius", &l.radius, 1, 0, 100);
 			ImGui::PopID();
 		}
+		ImGui::Text("%d lights (including emissive triangles)", int(pathtracer::getLightCount()));
+		if(lights_changed)
+		{
+			pathtracer::buildLights();
+			pathtracer::restart();
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Participating medium
+	///////////////////////////////////////////////////////////////////////////
+	if(ImGui::CollapsingHeader("Volume", "volume_ch", true, false))
+	{
+		bool changed = ImGui::Checkbox("Enable Volume", &pathtracer::volume.enabled);
+		changed |= ImGui::SliderFloat("Density", &pathtracer::volume.density_multiplier, 0.0f, 2.0f, "%.3f",
+		                              2.0f);
+		changed |= ImGui::ColorEdit3("Albedo", &pathtracer::volume.albedo.x);
+		changed |= ImGui::SliderFloat("Anisotropy", &pathtracer::volume.anisotropy, -0.95f, 0.95f);
+		vec3 center = pathtracer::volume.sphere_center;
+		float radius = pathtracer::volume.sphere_radius;
+		float noise = pathtracer::volume.sphere_noise;
+		bool grid_changed = ImGui::DragFloat3("Sphere Center", &center.x, 0.1f);
+		grid_changed |= ImGui::DragFloat("Sphere Radius", &radius, 0.1f, 0.1f, 100.0f);
+		grid_changed |= ImGui::SliderFloat("Noise", &noise, 0.0f, 1.0f);
+		if(grid_changed)
+		{
+			pathtracer::createSphereVolume(center, radius, noise, volume_grid_resolution);
+		}
+		if(changed || grid_changed)
+		{
+			pathtracer::restart();
+		}
 	}
 
 	ImGui::End(); // Control Panel
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Write the path traced image to <filename>.hdr and <filename>.png. The
+// image is copied and handed to the encoder threads, so rendering can go
+// on while it is written. The rendered image is stored bottom row first,
+// so it is flipped on the way.
+///////////////////////////////////////////////////////////////////////////////
+void saveRenderedImage(const std::string& filename)
+{
+	const int width = pathtracer::rendered_image.width;
+	const int height = pathtracer::rendered_image.height;
+	auto image = std::make_shared<std::vector<vec3>>(pathtracer::rendered_image.data);
+	labhelper::ToneMapSettings tone_map = tone_map_settings;
+	tone_map.flip_vertically = true;
+	labhelper::queueEncodeJob([filename, width, height, image, tone_map]() {
+		std::vector<float> img_hdr(width * height * 3);
+		for(int y = 0; y < height; y++)
+		{
+			const vec3* row = &(*image)[(height - 1 - y) * width];
+			std::copy(&row[0].x, &row[0].x + width * 3, &img_hdr[y * width * 3]);
+		}
+		std::vector<uint8_t> img_png = labhelper::toneMapImage(*image, width, height, tone_map);
+		stbi_write_hdr((filename + ".hdr").c_str(), width, height, 3, img_hdr.data());
+		stbi_write_png((filename + ".png").c_str(), width, height, 3, img_png.data(), 0);
+	});
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Headless mode: render one or more frames without a window or GL context
+// and write them to disk. Usage:
+//
+//   pathtracer --headless [--scene <name>] [--width <w>] [--height <h>]
+//              [--samples <spp>] [--max-bounces <n>] [--packet-size <n>]
+//              [--wavefront] [--queue-size <paths>] [--batch-size <paths>] [--share-buffers]
+//              [--adaptive <error threshold>] [--sampler sobol|independent]
+//              [--env-sampling importance|brdf] [--light-selection tree|power]
+//              [--volume <density>] [--volume-noise <amount>]
+//              [--output <file>] [--exposure <x>] [--tonemap clamp|reinhard|aces] [--srgb]
+//              [--camera <px> <py> <pz> <dx> <dy> <dz>]
+//              [--camera-file <file>] [--trace <file>]
+//
+// A camera file holds one camera per line ("px py pz dx dy dz"); frame i is
+// then written to <output>_<i>.hdr/png. Without a camera, the scene's
+// default camera is used. With --adaptive, --samples is the maximum number
+// of samples per pixel. --volume renders the default volume sphere with
+// the given density, made heterogeneous by --volume-noise (0 to 1).
+// --exposure scales the image before it is tone mapped to PNG, and --srgb
+// encodes the PNG with the sRGB curve instead of linearly (as displayed).
+// --trace writes a Chrome trace of the render (see profiler.h), with one
+// profiler frame per sample. --wavefront renders with the wavefront
+// integrator, with the given queue and batch sizes. --share-buffers lets
+// Embree use the models' vertex and index buffers instead of copies, for
+// scenes that barely fit in memory.
+///////////////////////////////////////////////////////////////////////////////
+int runHeadless(int argc, char* argv[])
+{
+	g_headless = true;
+
+	std::string scene_name = "Ship";
+	std::string output = "render";
+	std::string camera_file;
+	std::string trace_file;
+	int width = 1280, height = 720, samples = 64, max_bounces = 8, packet_size = 8;
+	bool wavefront = false, share_buffers = false;
+	int queue_size = 1 << 16, batch_size = 256;
+	float adaptive_error_threshold = 0.0f;
+	float volume_density = 0.0f, volume_noise = 0.0f;
+	bool environment_importance_sampling = true;
+	pathtracer::LightSelection light_selection = pathtracer::LIGHT_SELECTION_TREE;
+	pathtracer::SamplerType sampler = pathtracer::SAMPLER_SOBOL;
+	std::vector<camera_t> cameras;
+
+	for(int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		const int args_left = argc - 1 - i;
+		if(arg == "--headless")
+			continue;
+		else if(arg == "--scene" && args_left >= 1)
+			scene_name = argv[++i];
+		else if(arg == "--width" && args_left >= 1)
+			width = std::atoi(argv[++i]);
+		else if(arg == "--height" && args_left >= 1)
+			height = std::atoi(argv[++i]);
+		else if(arg == "--samples" && args_left >= 1)
+			samples = std::atoi(argv[++i]);
+		else if(arg == "--max-bounces" && args_left >= 1)
+			max_bounces = std::atoi(argv[++i]);
+		else if(arg == "--adaptive" && args_left >= 1)
+			adaptive_error_threshold = float(std::atof(argv[++i]));
+		else if(arg == "--sampler" && args_left >= 1)
+		{
+			std::string name = argv[++i];
+			if(name == "sobol")
+				sampler = pathtracer::SAMPLER_SOBOL;
+			else if(name == "independent")
+				sampler = pathtracer::SAMPLER_INDEPENDENT;
+			else
+			{
+				std::cerr << "Unknown sampler: " << name << "\n";
+				return 1;
+			}
+		}
+		else if(arg == "--env-sampling" && args_left >= 1)
+		{
+			std::string name = argv[++i];
+			if(name == "importance")
+				environment_importance_sampling = true;
+			else if(name == "brdf")
+				environment_importance_sampling = false;
+			else
+			{
+				std::cerr << "Unknown environment sampling: " << name << "\n";
+				return 1;
+			}
+		}
+		else if(arg == "--light-selection" && args_left >= 1)
+		{
+			std::string name = argv[++i];
+			if(name == "tree")
+				light_selection = pathtracer::LIGHT_SELECTION_TREE;
+			else if(name == "power")
+				light_selection = pathtracer::LIGHT_SELECTION_POWER;
+			else
+			{
+				std::cerr << "Unknown light selection: " << name << "\n";
+				return 1;
+			}
+		}
+		else if(arg == "--exposure" && args_left >= 1)
+			tone_map_settings.exposure = float(std::atof(argv[++i]));
+		else if(arg == "--tonemap" && args_left >= 1)
+		{
+			std::string name = argv[++i];
+			if(name == "clamp")
+				tone_map_settings.tone_operator = labhelper::TONEMAP_CLAMP;
+			else if(name == "reinhard")
+				tone_map_settings.tone_operator = labhelper::TONEMAP_REINHARD;
+			else if(name == "aces")
+				tone_map_settings.tone_operator = labhelper::TONEMAP_ACES;
+			else
+			{
+				std::cerr << "Unknown tone map operator: " << name << "\n";
+				return 1;
+			}
+		}
+		else if(arg == "--srgb")
+			tone_map_settings.srgb = true;
+		else if(arg == "--volume" && args_left >= 1)
+			volume_density = float(std::atof(argv[++i]));
+		else if(arg == "--volume-noise" && args_left >= 1)
+			volume_noise = float(std::atof(argv[++i]));
+		else if(arg == "--packet-size" && args_left >= 1)
+			packet_size = std::atoi(argv[++i]);
+		else if(arg == "--wavefront")
+			wavefront = true;
+		else if(arg == "--share-buffers")
+			share_buffers = true;
+		else if(arg == "--queue-size" && args_left >= 1)
+			queue_size = std::atoi(argv[++i]);
+		else if(arg == "--batch-size" && args_left >= 1)
+			batch_size = std::atoi(argv[++i]);
+		else if(arg == "--output" && args_left >= 1)
+			output = argv[++i];
+		else if(arg == "--camera-file" && args_left >= 1)
+			camera_file = argv[++i];
+		else if(arg == "--trace" && args_left >= 1)
+			trace_file = argv[++i];
+		else if(arg == "--camera" && args_left >= 6)
+		{
+			camera_t c;
+			c.position = vec3(std::atof(argv[i + 1]), std::atof(argv[i + 2]), std::atof(argv[i + 3]));
+			c.direction =
+			    normalize(vec3(std::atof(argv[i + 4]), std::atof(argv[i + 5]), std::atof(argv[i + 6])));
+			cameras.push_back(c);
+			i += 6;
+		}
+		else
+		{
+			std::cerr << "Unknown or incomplete argument: " << arg << "\n";
+			return 1;
+		}
+	}
+	if(width <= 0 || height <= 0 || samples <= 0 || queue_size <= 0 || batch_size <= 0)
+	{
+		std::cerr << "Width, height, samples, queue size and batch size must be positive.\n";
+		return 1;
+	}
+	if(!camera_file.empty())
+	{
+		std::ifstream file(camera_file);
+		if(!file.is_open())
+		{
+			std::cerr << "Could not open camera file " << camera_file << "\n";
+			return 1;
+		}
+		std::string line;
+		while(std::getline(file, line))
+		{
+			std::istringstream ss(line);
+			camera_t c;
+			if(ss >> c.position.x >> c.position.y >> c.position.z >> c.direction.x >> c.direction.y
+			   >> c.direction.z)
+			{
+				c.direction = normalize(c.direction);
+				cameras.push_back(c);
+			}
+		}
+	}
+
+	initializePathtracer();
+	if(scenes.find(scene_name) == scenes.end())
+	{
+		std::cerr << "Unknown scene: " << scene_name << "\n";
+		cleanupScenes();
+		return 1;
+	}
+	pathtracer::setShareModelBuffers(share_buffers);
+	changeScene(scene_name);
+	if(cameras.empty())
+	{
+		cameras.push_back(camera);
+	}
+
+	pathtracer::settings.subsampling = 1;
+	pathtracer::settings.max_bounces = max_bounces;
+	pathtracer::settings.ray_packet_size = packet_size;
+	pathtracer::settings.wavefront = wavefront;
+	pathtracer::settings.wavefront_queue_size = queue_size;
+	pathtracer::settings.wavefront_batch_size = batch_size;
+	pathtracer::settings.adaptive_sampling = adaptive_error_threshold > 0.0f;
+	pathtracer::settings.adaptive_error_threshold = adaptive_error_threshold;
+	pathtracer::settings.sampler = sampler;
+	pathtracer::settings.environment_importance_sampling = environment_importance_sampling;
+	pathtracer::settings.light_selection = light_selection;
+	pathtracer::settings.max_paths_per_pixel = 0;
+	if(volume_density > 0.0f)
+	{
+		pathtracer::volume.enabled = true;
+		pathtracer::volume.density_multiplier = volume_density;
+		pathtracer::createSphereVolume(pathtracer::volume.sphere_center, pathtracer::volume.sphere_radius,
+		                               volume_noise, volume_grid_resolution);
+	}
+	pathtracer::resize(width, height);
+
+	if(!trace_file.empty())
+	{
+		labhelper::startProfilerCapture();
+	}
+	double total_seconds = 0.0, total_samples = 0.0;
+	for(size_t frame = 0; frame < cameras.size(); frame++)
+	{
+		camera = cameras[frame];
+		mat4 viewMatrix = lookAt(camera.position, camera.position + camera.direction, worldUp);
+		mat4 projMatrix = perspective(radians(45.0f), float(width) / float(height), 0.1f, 100.0f);
+
+		pathtracer::restart();
+		auto start = std::chrono::high_resolution_clock::now();
+		for(int i = 0; i < samples; i++)
+		{
+			pathtracer::tracePaths(viewMatrix, projMatrix);
+			labhelper::profilerNewFrame();
+			if(pathtracer::settings.adaptive_sampling
+			   && pathtracer::rendered_image.number_of_active_pixels == 0)
+			{
+				break;
+			}
+		}
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		total_seconds += elapsed.count();
+		double frame_samples = 0.0;
+		for(int n : pathtracer::rendered_image.pixel_samples)
+		{
+			frame_samples += n;
+		}
+		total_samples += frame_samples;
+
+		std::string filename = output;
+		if(cameras.size() > 1)
+		{
+			std::ostringstream ss;
+			ss << output << "_" << std::setw(4) << std::setfill('0') << frame;
+			filename = ss.str();
+		}
+		saveRenderedImage(filename);
+		std::cout << "Frame " << frame << ": " << frame_samples / (double(width) * height) << " spp in "
+		          << elapsed.count() << " s (" << frame_samples / elapsed.count() / 1e6
+		          << " Msamples/s) -> " << filename << ".hdr/.png\n";
+	}
+	std::cout << "Rendered " << cameras.size() << " frame(s) in " << total_seconds << " s, "
+	          << total_samples / total_seconds / 1e6 << " Msamples/s on average.\n";
+	if(!trace_file.empty())
+	{
+		labhelper::saveProfilerCapture(trace_file);
+	}
+	labhelper::finishEncodeJobs();
+
+	cleanupScenes();
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Benchmark mode: render the Sphere, Ship and Refractions scenes from their
+// default cameras, at a fixed resolution and number of samples, and report
+// the timings as JSON. Usage:
+//
+//   pathtracer --benchmark [--width <w>] [--height <h>] [--samples <spp>]
+//              [--json <file>] [--baseline <file>] [--tolerance <fraction>]
+//
+// With --baseline (the JSON of an earlier run), each scene's samples/s is
+// compared to the baseline, and the exit code is 1 if a scene is more than
+// --tolerance (default 0.05) slower. The images are rendered with the Sobol
+// sampler, which is deterministic, so a change in a scene's mean luminance
+// means that the rendered result changed.
+//
+// Only the JSON is written to stdout, so that it can be piped. The progress
+// of loading the scenes and the comparison to the baseline go to stderr.
+///////////////////////////////////////////////////////////////////////////////
+struct BenchmarkResult
+{
+	std::string scene;
+	SceneBuildTimes build_times;
+	double render_seconds;
+	double tone_map_seconds;
+	double samples;
+	pathtracer::RayCounts rays;
+	double mean_luminance;
+};
+
+// Read `key` of the scene named `scene` from a JSON file written by
+// writeBenchmarkJson(). Returns false if it is not there.
+static bool readBenchmarkValue(const std::string& json, const std::string& scene, const std::string& key,
+                               double& value)
+{
+	size_t scene_start = json.find("\"scene\": \"" + scene + "\"");
+	if(scene_start == std::string::npos)
+	{
+		return false;
+	}
+	size_t scene_end = json.find('}', scene_start);
+	size_t key_start = json.find("\"" + key + "\":", scene_start);
+	if(key_start == std::string::npos || key_start > scene_end)
+	{
+		return false;
+	}
+	value = std::strtod(json.c_str() + key_start + key.size() + 3, nullptr);
+	return true;
+}
+
+static void writeBenchmarkJson(std::ostream& out, int width, int height, int samples, double load_seconds,
+                               const std::vector<BenchmarkResult>& results)
+{
+	out << "{\n";
+	out << "  \"width\": " << width << ",\n";
+	out << "  \"height\": " << height << ",\n";
+	out << "  \"samples_per_pixel\": " << samples << ",\n";
+	out << "  \"threads\": " << omp_get_max_threads() << ",\n";
+	out << "  \"model_load_seconds\": " << load_seconds << ",\n";
+	out << "  \"scenes\": [\n";
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult& r = results[i];
+		const double rays = double(r.rays.intersect + r.rays.occluded);
+		out << "    {\n";
+		out << "      \"scene\": \"" << r.scene << "\",\n";
+		out << "      \"add_models_seconds\": " << r.build_times.add_models_seconds << ",\n";
+		out << "      \"bvh_build_seconds\": " << r.build_times.bvh_build_seconds << ",\n";
+		out << "      \"light_build_seconds\": " << r.build_times.light_build_seconds << ",\n";
+		out << "      \"render_seconds\": " << r.render_seconds << ",\n";
+		out << "      \"tone_map_seconds\": " << r.tone_map_seconds << ",\n";
+		out << "      \"intersect_rays\": " << r.rays.intersect << ",\n";
+		out << "      \"occluded_rays\": " << r.rays.occluded << ",\n";
+		out << "      \"samples_per_second\": " << r.samples / r.render_seconds << ",\n";
+		out << "      \"mrays_per_second\": " << rays / r.render_seconds / 1e6 << ",\n";
+		out << "      \"mean_luminance\": " << r.mean_luminance << "\n";
+		out << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n";
+	out << "}\n";
+}
+
+int runBenchmark(int argc, char* argv[])
+{
+	g_headless = true;
+
+	int width = 640, height = 360, samples = 32;
+	std::string json_file, baseline_file;
+	double tolerance = 0.05;
+	for(int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		const int args_left = argc - 1 - i;
+		if(arg == "--benchmark")
+			continue;
+		else if(arg == "--width" && args_left >= 1)
+			width = std::atoi(argv[++i]);
+		else if(arg == "--height" && args_left >= 1)
+			height = std::atoi(argv[++i]);
+		else if(arg == "--samples" && args_left >= 1)
+			samples = std::atoi(argv[++i]);
+		else if(arg == "--json" && args_left >= 1)
+			json_file = argv[++i];
+		else if(arg == "--baseline" && args_left >= 1)
+			baseline_file = argv[++i];
+		else if(arg == "--tolerance" && args_left >= 1)
+			tolerance = std::atof(argv[++i]);
+		else
+		{
+			std::cerr << "Unknown or incomplete argument: " << arg << "\n";
+			return 1;
+		}
+	}
+	std::string baseline;
+	if(!baseline_file.empty())
+	{
+		std::ifstream file(baseline_file);
+		if(!file)
+		{
+			std::cerr << "Could not open baseline " << baseline_file << "\n";
+			return 1;
+		}
+		std::stringstream ss;
+		ss << file.rdbuf();
+		baseline = ss.str();
+	}
+
+	// The scenes print their progress to cout while they load
+	std::streambuf* stdout_buffer = std::cout.rdbuf(std::cerr.rdbuf());
+
+	auto start = std::chrono::high_resolution_clock::now();
+	initializePathtracer();
+	const double load_seconds = secondsSince(start);
+	pathtracer::settings.subsampling = 1;
+	pathtracer::settings.adaptive_sampling = false;
+	pathtracer::settings.max_paths_per_pixel = 0;
+	pathtracer::settings.sampler = pathtracer::SAMPLER_SOBOL;
+	pathtracer::resize(width, height);
+
+	std::vector<BenchmarkResult> results;
+	for(const char* scene : { "Sphere", "Ship", "Refractions" })
+	{
+		BenchmarkResult result;
+		result.scene = scene;
+		changeScene(scene);
+		result.build_times = scene_build_times;
+
+		mat4 viewMatrix = lookAt(camera.position, camera.position + camera.direction, worldUp);
+		mat4 projMatrix = perspective(radians(45.0f), float(width) / float(height), 0.1f, 100.0f);
+		pathtracer::restart();
+		pathtracer::resetRayCounts();
+		start = std::chrono::high_resolution_clock::now();
+		for(int i = 0; i < samples; i++)
+		{
+			pathtracer::tracePaths(viewMatrix, projMatrix);
+		}
+		result.render_seconds = secondsSince(start);
+		result.rays = pathtracer::getRayCounts();
+		result.samples = double(width) * height * samples;
+
+		start = std::chrono::high_resolution_clock::now();
+		labhelper::toneMapImage(pathtracer::rendered_image.data, width, height, tone_map_settings);
+		result.tone_map_seconds = secondsSince(start);
+
+		double luminance = 0.0;
+		for(const vec3& c : pathtracer::rendered_image.data)
+		{
+			luminance += dot(c, vec3(0.2126f, 0.7152f, 0.0722f));
+		}
+		result.mean_luminance = luminance / pathtracer::rendered_image.data.size();
+		results.push_back(result);
+	}
+
+	std::cout.rdbuf(stdout_buffer);
+	writeBenchmarkJson(std::cout, width, height, samples, load_seconds, results);
+	if(!json_file.empty())
+	{
+		std::ofstream file(json_file);
+		writeBenchmarkJson(file, width, height, samples, load_seconds, results);
+	}
+
+	bool regressed = false;
+	if(!baseline.empty())
+	{
+		for(const BenchmarkResult& r : results)
+		{
+			double baseline_samples_per_second, baseline_luminance;
+			if(!readBenchmarkValue(baseline, r.scene, "samples_per_second", baseline_samples_per_second))
+			{
+				std::cerr << r.scene << ": not in the baseline\n";
+				continue;
+			}
+			const double ratio = r.samples / r.render_seconds / baseline_samples_per_second;
+			std::ostringstream change;
+			change << std::fixed << std::setprecision(1) << (ratio - 1.0) * 100.0;
+			std::cerr << r.scene << ": " << change.str() << "% samples/s compared to the baseline";
+			if(ratio < 1.0 - tolerance)
+			{
+				std::cerr << " (REGRESSION)";
+				regressed = true;
+			}
+			std::cerr << "\n";
+			if(readBenchmarkValue(baseline, r.scene, "mean_luminance", baseline_luminance)
+			   && std::abs(r.mean_luminance - baseline_luminance) > 1e-3 * std::abs(baseline_luminance))
+			{
+				std::cerr << r.scene << ": mean luminance " << r.mean_luminance
+				          << " differs from the baseline (" << baseline_luminance
+				          << "), the rendered image has changed\n";
+			}
+		}
+	}
+
+	cleanupScenes();
+	return regressed ? 1 : 0;
+}
+
 int main(int argc, char* argv[])
 {
+	for(int i = 1; i < argc; i++)
+	{
+		if(std::string(argv[i]) == "--headless")
+		{
+			return runHeadless(argc, argv);
+		}
+		if(std::string(argv[i]) == "--benchmark")
+		{
+			return runBenchmark(argc, argv);
+		}
+	}
+
 	g_window = labhelper::init_window_SDL("Pathtracer", 1280, 720);
 
 	initialize();
@@ -609,18 +1453,31 @@ int main(int argc, char* argv[])
 		if(showUI)
 		{
 			gui();
+			labhelper::profilerGui();
 		}
 
 		// Render the GUI.
-		ImGui::Render();
+		{
+			PROFILE_GPU_SCOPE("GUI");
+			ImGui::Render();
+		}
 
 		// Swap front and back buffer. This frame will now be displayed.
 		SDL_GL_SwapWindow(g_window);
+
+		// Write out screenshots that have been read back
+		labhelper::pollScreenshots();
+
+		// Collect this frame's timings
+		labhelper::profilerNewFrame();
 	}
 
 	// Delete Models
 	cleanupScenes();
 
+	glDeleteBuffers(2, pathtracer_result_pbos);
+	glDeleteTextures(1, &pathtracer_result_txt_id);
+
 	// Shut down everything. This includes the window and all other subsystems.
 	labhelper::shutDown(g_window);
 	return 0;
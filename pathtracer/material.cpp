@@ -1,6 +1,7 @@
 #include "material.h"
 #include "sampling.h"
 #include "labhelper.h"
+#include "texture.h"
 
 using namespace labhelper;
 
@@ -36,6 +37,25 @@ WiSample Diffuse::sample_wi(const vec3& wo, const vec3& n) const
 	return r;
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Compile a material for rendering. Only the diffuse lobe is rendered for
+// now; the remaining parameters will be baked in with their lobes.
+///////////////////////////////////////////////////////////////////////////
+CompiledMaterial compileMaterial(const labhelper::Material& material)
+{
+	CompiledMaterial compiled;
+	compiled.color = material.m_color;
+	compiled.emission = material.m_emission;
+	compiled.color_texture = nullptr;
+	if(material.m_color_texture.valid)
+	{
+		compiled.color_texture = getModelTexture(material.m_color_texture);
+	}
+	// The texture only scales the color, so can't make a black material reflect
+	compiled.type = compiled.color == vec3(0.0f) ? MATERIAL_BLACK : MATERIAL_DIFFUSE;
+	return compiled;
+}
+
 vec3 MicrofacetBRDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
 {
 	return vec3(0.0f);
@@ -2,6 +2,7 @@
 #include <glm/glm.hpp>
 #include "Pathtracer.h"
 #include "sampling.h"
+#include "texture.h"
 
 using namespace glm;
 
@@ -191,5 +192,64 @@ public:
 };
 #endif
 
+///////////////////////////////////////////////////////////////////////////
+/// A material compiled for rendering. Each labhelper::Material is baked
+/// into this plain parameter block once, when the scene is built (see
+/// compileMaterial()), and the renderer shades with the inline functions
+/// below, which switch on `type` instead of calling through the BSDF
+/// classes above.
+///////////////////////////////////////////////////////////////////////////
+enum MaterialType : uint32_t
+{
+	// Reflects nothing (black, untextured), so needs no light sampling
+	MATERIAL_BLACK,
+	// Lambertian
+	MATERIAL_DIFFUSE,
+};
+
+struct CompiledMaterial
+{
+	MaterialType type;
+	vec3 color;
+	vec3 emission;
+	// The color is multiplied by this texture, unless it is nullptr
+	const FilteredTexture* color_texture;
+};
+
+CompiledMaterial compileMaterial(const labhelper::Material& material);
+
+// A cosine weighted direction about n (with f left 0)
+WiSample sampleHemisphereCosine(const vec3& wo, const vec3& n);
+
+///////////////////////////////////////////////////////////////////////////
+/// Evaluate a compiled material whose `color` has been textured for the
+/// hit point, as BTDF::f() and BTDF::sample_wi() would.
+///////////////////////////////////////////////////////////////////////////
+inline vec3 evaluateMaterial(const CompiledMaterial& material, const vec3& wi, const vec3& wo, const vec3& n)
+{
+	switch(material.type)
+	{
+	case MATERIAL_DIFFUSE:
+		if(dot(wi, n) <= 0.0f || dot(wo, n) <= 0.0f)
+			return vec3(0.0f);
+		return (1.0f / M_PI) * material.color;
+	default:
+		return vec3(0.0f);
+	}
+}
+
+inline WiSample sampleMaterial(const CompiledMaterial& material, const vec3& wo, const vec3& n)
+{
+	WiSample r;
+	switch(material.type)
+	{
+	case MATERIAL_DIFFUSE:
+		r = sampleHemisphereCosine(wo, n);
+		r.f = evaluateMaterial(material, r.wi, wo, n);
+		return r;
+	default:
+		return r;
+	}
+}
 
 } // namespace pathtracer
@@ -1,22 +1,130 @@
 #include "sampling.h"
-#include <random>
 #include "labhelper.h"
-#include <omp.h>
 #include <iostream>
 #include <glm/glm.hpp>
+#include <algorithm>
 
 using namespace glm;
 
 namespace pathtracer
 {
 ///////////////////////////////////////////////////////////////////////////////
-// Get a random float. Note that we need one "generator" per thread, or we
-// would need to lock everytime someone called randf().
+// The sample that the calling thread is currently taking. Since the random
+// numbers are computed from this counter rather than from a stateful
+// generator, the threads never share any generator state.
+///////////////////////////////////////////////////////////////////////////////
+struct SamplerState
+{
+	uint32_t pixel = 0;
+	uint32_t sample_index = 0;
+	uint32_t dimension = 0;
+	SamplerType type = SAMPLER_INDEPENDENT;
+};
+static thread_local SamplerState sampler_state;
+
+void beginSample(uint32_t pixel, uint32_t sample_index, SamplerType type, uint32_t dimension)
+{
+	sampler_state.pixel = pixel;
+	sampler_state.sample_index = sample_index;
+	sampler_state.dimension = dimension;
+	sampler_state.type = type;
+}
+
+uint32_t sampleDimension()
+{
+	return sampler_state.dimension;
+}
+
+uvec3 pcg3d(uvec3 v)
+{
+	v = v * 1664525u + 1013904223u;
+
+	v.x += v.y * v.z;
+	v.y += v.z * v.x;
+	v.z += v.x * v.y;
+
+	v = v ^ (v >> 16u);
+
+	v.x += v.y * v.z;
+	v.y += v.z * v.x;
+	v.z += v.x * v.y;
+
+	return v;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Owen scrambled Sobol, following Burley, "Practical Hash-based Owen
+// Scrambling" (JCGT 2020). Dimensions are consumed in pairs; each pair uses
+// the first two Sobol dimensions with a differently shuffled (scrambled)
+// index, which pads the sequence to an arbitrary number of dimensions.
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t reverseBits(uint32_t v)
+{
+	v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+	v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+	v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+	v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+	return (v >> 16) | (v << 16);
+}
+
+static uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+{
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1u;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+	return x;
+}
+
+static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+	return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+static uint32_t sobol(uint32_t index, uint32_t dimension)
+{
+	if(dimension == 0)
+	{
+		return reverseBits(index);
+	}
+	// Second dimension: direction numbers v_i = v_{i-1} ^ (v_{i-1} >> 1)
+	uint32_t result = 0;
+	for(uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+	{
+		if(index & 1u)
+			result ^= v;
+	}
+	return result;
+}
+
+static uint32_t owenScrambledSobol(uint32_t index, uint32_t dimension, uint32_t seed)
+{
+	const uint32_t pair_seed = pcg3d(uvec3(seed, dimension / 2, 0x9e3779b9u)).x;
+	const uint32_t shuffled_index = nestedUniformScramble(index, pair_seed);
+	const uint32_t x = sobol(shuffled_index, dimension % 2);
+	return nestedUniformScramble(x, pcg3d(uvec3(pair_seed, dimension % 2, 0x85ebca6bu)).x);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Get a random float in [0, 1). The value is a function of the current
+// pixel, sample and dimension only (see beginSample()).
 ///////////////////////////////////////////////////////////////////////////////
-std::mt19937 generators[24]; // Assuming no more than 24 cores
 float randf()
 {
-	return float(generators[omp_get_thread_num()]() / double(generators[omp_get_thread_num()].max()));
+	SamplerState& state = sampler_state;
+	const uint32_t dimension = state.dimension++;
+	uint32_t bits;
+	if(state.type == SAMPLER_SOBOL)
+	{
+		bits = owenScrambledSobol(state.sample_index, dimension, state.pixel);
+	}
+	else
+	{
+		bits = pcg3d(uvec3(state.pixel, state.sample_index, dimension)).x;
+	}
+	// Use the top 24 bits, which convert exactly to a float below 1
+	return float(bits >> 8) * (1.0f / 16777216.0f);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -79,6 +187,64 @@ glm::vec3 cosineSampleHemisphere()
 	return ret;
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Vose's construction of the alias table: split the buckets into those
+// with less and more than the average probability, and let each small
+// bucket be topped up by a large one.
+///////////////////////////////////////////////////////////////////////////
+void AliasTable::build(const float* weights, size_t n)
+{
+	threshold.assign(n, 1.0f);
+	alias.resize(n);
+	pmf.resize(n);
+	total_weight = 0.0;
+	for(size_t i = 0; i < n; i++)
+	{
+		total_weight += weights[i];
+		alias[i] = uint32_t(i);
+	}
+	if(n == 0)
+	{
+		return;
+	}
+	std::vector<double> scaled(n);
+	std::vector<uint32_t> small, large;
+	for(size_t i = 0; i < n; i++)
+	{
+		pmf[i] = total_weight > 0.0 ? float(weights[i] / total_weight) : 1.0f / float(n);
+		scaled[i] = total_weight > 0.0 ? weights[i] / total_weight * double(n) : 1.0;
+		(scaled[i] < 1.0 ? small : large).push_back(uint32_t(i));
+	}
+	while(!small.empty() && !large.empty())
+	{
+		const uint32_t s = small.back();
+		small.pop_back();
+		const uint32_t l = large.back();
+		threshold[s] = float(scaled[s]);
+		alias[s] = l;
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+		if(scaled[l] < 1.0)
+		{
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// What is left is (up to rounding) exactly average
+	for(uint32_t i : small)
+		threshold[i] = 1.0f;
+	for(uint32_t i : large)
+		threshold[i] = 1.0f;
+}
+
+uint32_t AliasTable::sample(float u) const
+{
+	// The integer part of u * n picks the bucket, the fraction decides
+	// between the bucket and its alias
+	const float scaled = u * float(pmf.size());
+	const uint32_t bucket = std::min(uint32_t(scaled), uint32_t(pmf.size() - 1));
+	return scaled - float(bucket) < threshold[bucket] ? bucket : alias[bucket];
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Check if wi and wo are on the same side of the plane defined by n
 ///////////////////////////////////////////////////////////////////////////
@@ -1,13 +1,46 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
 
 namespace pathtracer
 {
+///////////////////////////////////////////////////////////////////////////
+// Sample sequences used by randf()
+///////////////////////////////////////////////////////////////////////////
+enum SamplerType
+{
+	// Independent uniform random numbers from a counter-based (PCG) hash
+	SAMPLER_INDEPENDENT = 0,
+	// Owen scrambled Sobol points, padded to any number of dimensions
+	SAMPLER_SOBOL = 1,
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Start sample `sample_index` of pixel `pixel` on the calling thread.
+// Every randf() call that follows returns the next dimension of that
+// sample, so the result only depends on (pixel, sample, dimension) and
+// not on which thread renders the pixel. A sample that was interrupted
+// can be resumed on any thread by passing the dimension it had reached
+// (see sampleDimension()).
+///////////////////////////////////////////////////////////////////////////
+void beginSample(uint32_t pixel, uint32_t sample_index, SamplerType type, uint32_t dimension = 0);
+
+///////////////////////////////////////////////////////////////////////////
+// The dimension the next randf() call on the calling thread returns
+///////////////////////////////////////////////////////////////////////////
+uint32_t sampleDimension();
+
 ///////////////////////////////////////////////////////////////////////////
 // Random number generation
 ///////////////////////////////////////////////////////////////////////////
 float randf();
 
+///////////////////////////////////////////////////////////////////////////
+// Counter-based hash, the same as pcg3d in project/irradianceMap.frag
+///////////////////////////////////////////////////////////////////////////
+glm::uvec3 pcg3d(glm::uvec3 v);
+
 ///////////////////////////////////////////////////////////////////////////
 // Generate uniform points on a disc
 ///////////////////////////////////////////////////////////////////////////
@@ -18,6 +51,30 @@ glm::vec2 concentricSampleDisk();
 ///////////////////////////////////////////////////////////////////////////
 glm::vec3 cosineSampleHemisphere();
 
+///////////////////////////////////////////////////////////////////////////
+// Walker's alias table: draws index i with probability pmf[i] (the
+// normalized weights) in constant time, from a single uniform number.
+///////////////////////////////////////////////////////////////////////////
+struct AliasTable
+{
+	// Probability of keeping bucket i rather than taking its alias
+	std::vector<float> threshold;
+	std::vector<uint32_t> alias;
+	std::vector<float> pmf;
+	// Sum of the weights the table was built from
+	double total_weight = 0.0;
+
+	// Build from non-negative weights. If they are all zero, every index
+	// is equally likely.
+	void build(const float* weights, size_t n);
+	// Draw an index with u in [0, 1)
+	uint32_t sample(float u) const;
+	size_t size() const
+	{
+		return pmf.size();
+	}
+};
+
 ///////////////////////////////////////////////////////////////////////////
 // Check if wi and wo are on the same side of the plane defined by n
 ///////////////////////////////////////////////////////////////////////////
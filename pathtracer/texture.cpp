@@ -0,0 +1,213 @@
+#include "texture.h"
+#include <Model.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Texels are stored in 4x4 blocks, the blocks in row major order
+///////////////////////////////////////////////////////////////////////////
+const int block_size = 4;
+
+const vec4& FilteredTexture::Level::texel(int x, int y) const
+{
+	const int block = (y / block_size) * blocks_x + x / block_size;
+	return texels[block * block_size * block_size + (y % block_size) * block_size + x % block_size];
+}
+
+vec4& FilteredTexture::Level::texel(int x, int y)
+{
+	const int block = (y / block_size) * blocks_x + x / block_size;
+	return texels[block * block_size * block_size + (y % block_size) * block_size + x % block_size];
+}
+
+static vec4 expandTexel(const float* c, int components)
+{
+	switch(components)
+	{
+	case 1:
+		return vec4(c[0], c[0], c[0], 1.0f);
+	case 2:
+		return vec4(c[0], c[1], 0.0f, 1.0f);
+	case 3:
+		return vec4(c[0], c[1], c[2], 1.0f);
+	default:
+		return vec4(c[0], c[1], c[2], c[3]);
+	}
+}
+
+void FilteredTexture::build(const float* texels,
+                            int width,
+                            int height,
+                            int components,
+                            TextureWrap wrap_u,
+                            TextureWrap wrap_v)
+{
+	this->wrap_u = wrap_u;
+	this->wrap_v = wrap_v;
+	std::vector<vec4> image(size_t(width) * height);
+#pragma omp parallel for
+	for(int i = 0; i < width * height; i++)
+	{
+		image[i] = expandTexel(&texels[size_t(i) * components], components);
+	}
+	buildLevels(image, width, height);
+}
+
+void FilteredTexture::build(const uint8_t* texels,
+                            int width,
+                            int height,
+                            int components,
+                            TextureWrap wrap_u,
+                            TextureWrap wrap_v)
+{
+	this->wrap_u = wrap_u;
+	this->wrap_v = wrap_v;
+	std::vector<vec4> image(size_t(width) * height);
+#pragma omp parallel for
+	for(int i = 0; i < width * height; i++)
+	{
+		float c[4];
+		for(int j = 0; j < components; j++)
+		{
+			c[j] = texels[size_t(i) * components + j] / 255.0f;
+		}
+		image[i] = expandTexel(c, components);
+	}
+	buildLevels(image, width, height);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Each level halves the size of the one above (rounding up), and each of
+// its texels is the average of the (up to) 2x2 texels it covers.
+///////////////////////////////////////////////////////////////////////////
+void FilteredTexture::buildLevels(const std::vector<vec4>& image, int width, int height)
+{
+	levels.clear();
+	for(;;)
+	{
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.blocks_x = (width + block_size - 1) / block_size;
+		const int blocks_y = (height + block_size - 1) / block_size;
+		level.texels.resize(size_t(level.blocks_x) * blocks_y * block_size * block_size);
+		if(levels.empty())
+		{
+#pragma omp parallel for
+			for(int y = 0; y < height; y++)
+			{
+				for(int x = 0; x < width; x++)
+				{
+					level.texel(x, y) = image[size_t(y) * width + x];
+				}
+			}
+		}
+		else
+		{
+			const Level& above = levels.back();
+#pragma omp parallel for
+			for(int y = 0; y < height; y++)
+			{
+				const int y0 = 2 * y, y1 = std::min(2 * y + 1, above.height - 1);
+				for(int x = 0; x < width; x++)
+				{
+					const int x0 = 2 * x, x1 = std::min(2 * x + 1, above.width - 1);
+					level.texel(x, y) = 0.25f
+					                    * (above.texel(x0, y0) + above.texel(x1, y0) + above.texel(x0, y1)
+					                       + above.texel(x1, y1));
+				}
+			}
+		}
+		levels.push_back(std::move(level));
+		if(width == 1 && height == 1)
+		{
+			break;
+		}
+		width = std::max(1, (width + 1) / 2);
+		height = std::max(1, (height + 1) / 2);
+	}
+}
+
+int FilteredTexture::width() const
+{
+	return levels.empty() ? 0 : levels[0].width;
+}
+
+int FilteredTexture::height() const
+{
+	return levels.empty() ? 0 : levels[0].height;
+}
+
+int FilteredTexture::levelCount() const
+{
+	return int(levels.size());
+}
+
+int FilteredTexture::wrap(int x, int size, TextureWrap mode) const
+{
+	if(mode == TEXTURE_WRAP_CLAMP)
+	{
+		return std::min(std::max(x, 0), size - 1);
+	}
+	x %= size;
+	return x < 0 ? x + size : x;
+}
+
+vec4 FilteredTexture::sampleBilinear(vec2 uv, int level_index) const
+{
+	const Level& level = levels[std::min(std::max(level_index, 0), int(levels.size()) - 1)];
+	// Texel centers are at half integer coordinates
+	const float x = uv.x * level.width - 0.5f;
+	const float y = uv.y * level.height - 0.5f;
+	const float fx = std::floor(x), fy = std::floor(y);
+	const float tx = x - fx, ty = y - fy;
+	const int x0 = wrap(int(fx), level.width, wrap_u), x1 = wrap(int(fx) + 1, level.width, wrap_u);
+	const int y0 = wrap(int(fy), level.height, wrap_v), y1 = wrap(int(fy) + 1, level.height, wrap_v);
+	const vec4 bottom = mix(level.texel(x0, y0), level.texel(x1, y0), tx);
+	const vec4 top = mix(level.texel(x0, y1), level.texel(x1, y1), tx);
+	return mix(bottom, top, ty);
+}
+
+vec4 FilteredTexture::sampleTrilinear(vec2 uv, float texels) const
+{
+	const float lod = texels > 1.0f ? std::log2(texels) : 0.0f;
+	const int level = int(lod);
+	if(level >= int(levels.size()) - 1)
+	{
+		return sampleBilinear(uv, int(levels.size()) - 1);
+	}
+	const float t = lod - float(level);
+	if(t == 0.0f)
+	{
+		return sampleBilinear(uv, level);
+	}
+	return mix(sampleBilinear(uv, level), sampleBilinear(uv, level + 1), t);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Model textures
+///////////////////////////////////////////////////////////////////////////
+static std::map<const labhelper::Texture*, std::unique_ptr<FilteredTexture>> model_textures;
+
+const FilteredTexture* getModelTexture(const labhelper::Texture& texture)
+{
+	std::unique_ptr<FilteredTexture>& filtered = model_textures[&texture];
+	if(!filtered)
+	{
+		filtered.reset(new FilteredTexture);
+		filtered->build(texture.data, texture.width, texture.height, texture.n_components);
+	}
+	return filtered.get();
+}
+
+void clearModelTextures()
+{
+	model_textures.clear();
+}
+} // namespace pathtracer
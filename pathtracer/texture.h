@@ -0,0 +1,78 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace labhelper
+{
+struct Texture;
+}
+
+namespace pathtracer
+{
+enum TextureWrap
+{
+	TEXTURE_WRAP_REPEAT,
+	TEXTURE_WRAP_CLAMP,
+};
+
+///////////////////////////////////////////////////////////////////////////
+// A texture prepared for filtered lookups on the CPU. The image and a
+// pyramid of box filtered mip levels are stored as RGBA floats (one
+// aligned 16 byte load per texel), and each level is laid out in blocks
+// of 4x4 texels, so that the texels of a bilinear lookup, and those of
+// lookups close by, are close in memory.
+///////////////////////////////////////////////////////////////////////////
+class FilteredTexture
+{
+public:
+	// Build from width * height texels of `components` floats, or of bytes
+	// (which are scaled to [0, 1]). Components missing from RGBA are
+	// filled in as for GL (a single component is replicated, alpha is 1).
+	void build(const float* texels,
+	           int width,
+	           int height,
+	           int components,
+	           TextureWrap wrap_u = TEXTURE_WRAP_REPEAT,
+	           TextureWrap wrap_v = TEXTURE_WRAP_REPEAT);
+	void build(const uint8_t* texels,
+	           int width,
+	           int height,
+	           int components,
+	           TextureWrap wrap_u = TEXTURE_WRAP_REPEAT,
+	           TextureWrap wrap_v = TEXTURE_WRAP_REPEAT);
+
+	int width() const;
+	int height() const;
+	int levelCount() const;
+
+	// Bilinear lookup in one mip level
+	glm::vec4 sampleBilinear(glm::vec2 uv, int level = 0) const;
+
+	// Trilinear lookup for a footprint `texels` (level 0 texels) wide,
+	// e.g. from a ray differential or ray cone
+	glm::vec4 sampleTrilinear(glm::vec2 uv, float texels) const;
+
+private:
+	struct Level
+	{
+		int width, height;
+		int blocks_x;
+		std::vector<glm::vec4> texels;
+		const glm::vec4& texel(int x, int y) const;
+		glm::vec4& texel(int x, int y);
+	};
+	void buildLevels(const std::vector<glm::vec4>& image, int width, int height);
+	int wrap(int x, int size, TextureWrap mode) const;
+
+	std::vector<Level> levels;
+	TextureWrap wrap_u = TEXTURE_WRAP_REPEAT, wrap_v = TEXTURE_WRAP_REPEAT;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Filtered versions of model textures, built on first use and kept until
+// clearModelTextures() (call it when the models may have changed)
+///////////////////////////////////////////////////////////////////////////
+const FilteredTexture* getModelTexture(const labhelper::Texture& texture);
+void clearModelTextures();
+} // namespace pathtracer
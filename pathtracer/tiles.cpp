@@ -0,0 +1,109 @@
+#include "tiles.h"
+#include <algorithm>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Interleave the lower 16 bits of x and y into a Morton code
+///////////////////////////////////////////////////////////////////////////
+static uint32_t spreadBits(uint32_t v)
+{
+	v &= 0x0000ffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+static uint32_t mortonCode(uint32_t x, uint32_t y)
+{
+	return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Split the image into Morton ordered tiles
+///////////////////////////////////////////////////////////////////////////
+std::vector<Tile> createTiles(int width, int height, int tile_size)
+{
+	tile_size = std::max(tile_size, 1);
+	const int tiles_x = (width + tile_size - 1) / tile_size;
+	const int tiles_y = (height + tile_size - 1) / tile_size;
+
+	std::vector<std::pair<uint32_t, Tile>> keyed_tiles;
+	keyed_tiles.reserve(tiles_x * tiles_y);
+	for(int ty = 0; ty < tiles_y; ty++)
+	{
+		for(int tx = 0; tx < tiles_x; tx++)
+		{
+			Tile tile;
+			tile.x0 = tx * tile_size;
+			tile.y0 = ty * tile_size;
+			tile.x1 = std::min(tile.x0 + tile_size, width);
+			tile.y1 = std::min(tile.y0 + tile_size, height);
+			keyed_tiles.push_back({ mortonCode(tx, ty), tile });
+		}
+	}
+	std::sort(keyed_tiles.begin(), keyed_tiles.end(),
+	          [](const std::pair<uint32_t, Tile>& a, const std::pair<uint32_t, Tile>& b) {
+		          return a.first < b.first;
+	          });
+
+	std::vector<Tile> tiles;
+	tiles.reserve(keyed_tiles.size());
+	for(const auto& keyed_tile : keyed_tiles)
+	{
+		tiles.push_back(keyed_tile.second);
+	}
+	return tiles;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Give each thread a contiguous run of the tiles
+///////////////////////////////////////////////////////////////////////////
+void TileScheduler::reset(const std::vector<Tile>& tiles, int num_threads)
+{
+	num_threads = std::max(num_threads, 1);
+	if(num_threads != num_queues)
+	{
+		queues.reset(new Queue[num_threads]);
+		num_queues = num_threads;
+	}
+	const size_t tiles_per_thread = (tiles.size() + num_threads - 1) / num_threads;
+	for(int i = 0; i < num_queues; i++)
+	{
+		const size_t begin = std::min(i * tiles_per_thread, tiles.size());
+		const size_t end = std::min(begin + tiles_per_thread, tiles.size());
+		queues[i].tiles.assign(tiles.begin() + begin, tiles.begin() + end);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Pop from our own queue, or steal from someone else's
+///////////////////////////////////////////////////////////////////////////
+bool TileScheduler::next(int thread_id, Tile& tile)
+{
+	{
+		Queue& own = queues[thread_id % num_queues];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if(!own.tiles.empty())
+		{
+			tile = own.tiles.front();
+			own.tiles.pop_front();
+			return true;
+		}
+	}
+	for(int i = 1; i < num_queues; i++)
+	{
+		Queue& victim = queues[(thread_id + i) % num_queues];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if(!victim.tiles.empty())
+		{
+			tile = victim.tiles.back();
+			victim.tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+} // namespace pathtracer
@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// A rectangular region of the image, [x0, x1) x [y0, y1)
+///////////////////////////////////////////////////////////////////////////
+struct Tile
+{
+	int x0, y0;
+	int x1, y1;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Split an image into tiles of (at most) tile_size x tile_size pixels,
+// ordered along a Morton (Z-order) curve so that consecutive tiles are
+// close to each other on screen.
+///////////////////////////////////////////////////////////////////////////
+std::vector<Tile> createTiles(int width, int height, int tile_size);
+
+///////////////////////////////////////////////////////////////////////////
+// Distributes tiles over threads. Every thread gets its own deque with a
+// contiguous run of (Morton ordered) tiles that it consumes from the
+// front. A thread that runs out of work steals from the back of another
+// thread's deque, so expensive regions of the image do not leave the
+// other cores idle at the end of a pass.
+///////////////////////////////////////////////////////////////////////////
+class TileScheduler
+{
+public:
+	// Hand out `tiles` to `num_threads` threads. Must not be called while
+	// any thread is calling next().
+	void reset(const std::vector<Tile>& tiles, int num_threads);
+
+	// Get the next tile to render for thread `thread_id`. Returns false
+	// when there is no work left anywhere.
+	bool next(int thread_id, Tile& tile);
+
+private:
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<Tile> tiles;
+		// Keep the queues of different threads on different cache lines
+		char padding[64];
+	};
+	std::unique_ptr<Queue[]> queues;
+	int num_queues = 0;
+};
+} // namespace pathtracer
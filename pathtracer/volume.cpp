@@ -0,0 +1,211 @@
+#include "volume.h"
+#include "Pathtracer.h"
+#include "sampling.h"
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+using namespace glm;
+
+namespace pathtracer
+{
+Volume volume;
+
+///////////////////////////////////////////////////////////////////////////
+// Trilinear lookup between the voxel centers
+///////////////////////////////////////////////////////////////////////////
+float DensityGrid::lookup(const vec3& p) const
+{
+	if(any(lessThan(p, bounds_min)) || any(greaterThan(p, bounds_max)))
+	{
+		return 0.0f;
+	}
+	const vec3 voxel = (p - bounds_min) / (bounds_max - bounds_min) * vec3(resolution) - 0.5f;
+	const vec3 base = floor(voxel);
+	const vec3 f = voxel - base;
+	const ivec3 i0 = clamp(ivec3(base), ivec3(0), resolution - 1);
+	const ivec3 i1 = clamp(ivec3(base) + 1, ivec3(0), resolution - 1);
+	auto at = [this](int x, int y, int z) {
+		return density[(size_t(z) * resolution.y + y) * resolution.x + x];
+	};
+	const float d00 = mix(at(i0.x, i0.y, i0.z), at(i1.x, i0.y, i0.z), f.x);
+	const float d10 = mix(at(i0.x, i1.y, i0.z), at(i1.x, i1.y, i0.z), f.x);
+	const float d01 = mix(at(i0.x, i0.y, i1.z), at(i1.x, i0.y, i1.z), f.x);
+	const float d11 = mix(at(i0.x, i1.y, i1.z), at(i1.x, i1.y, i1.z), f.x);
+	return mix(mix(d00, d10, f.y), mix(d01, d11, f.y), f.z);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Slab test against the bounds of the grid
+///////////////////////////////////////////////////////////////////////////
+bool DensityGrid::clip(const vec3& o, const vec3& d, float& t0, float& t1) const
+{
+	const vec3 inverse_d = 1.0f / d;
+	const vec3 ta = (bounds_min - o) * inverse_d;
+	const vec3 tb = (bounds_max - o) * inverse_d;
+	const vec3 t_near = min(ta, tb);
+	const vec3 t_far = max(ta, tb);
+	t0 = std::max(t0, std::max(t_near.x, std::max(t_near.y, t_near.z)));
+	t1 = std::min(t1, std::min(t_far.x, std::min(t_far.y, t_far.z)));
+	return t0 < t1;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Value noise in [0, 1] on the integer lattice, summed over octaves
+///////////////////////////////////////////////////////////////////////////
+static float latticeValue(const ivec3& p)
+{
+	return float(pcg3d(uvec3(p + 0x8000)).x) * (1.0f / 4294967296.0f);
+}
+
+static float valueNoise(const vec3& p)
+{
+	const vec3 base = floor(p);
+	const ivec3 i = ivec3(base);
+	vec3 f = p - base;
+	f = f * f * (3.0f - 2.0f * f);
+	const float n00 = mix(latticeValue(i), latticeValue(i + ivec3(1, 0, 0)), f.x);
+	const float n10 = mix(latticeValue(i + ivec3(0, 1, 0)), latticeValue(i + ivec3(1, 1, 0)), f.x);
+	const float n01 = mix(latticeValue(i + ivec3(0, 0, 1)), latticeValue(i + ivec3(1, 0, 1)), f.x);
+	const float n11 = mix(latticeValue(i + ivec3(0, 1, 1)), latticeValue(i + ivec3(1, 1, 1)), f.x);
+	return mix(mix(n00, n10, f.y), mix(n01, n11, f.y), f.z);
+}
+
+static float fractalNoise(vec3 p)
+{
+	float sum = 0.0f, amplitude = 0.5f;
+	for(int octave = 0; octave < 4; octave++)
+	{
+		sum += amplitude * valueNoise(p);
+		p *= 2.0f;
+		amplitude *= 0.5f;
+	}
+	return sum / (1.0f - amplitude);
+}
+
+void createSphereVolume(const vec3& center, float radius, float noise, int resolution)
+{
+	DensityGrid& grid = volume.grid;
+	grid.resolution = ivec3(std::max(resolution, 1));
+	grid.bounds_min = center - vec3(radius);
+	grid.bounds_max = center + vec3(radius);
+	grid.density.resize(size_t(grid.resolution.x) * grid.resolution.y * grid.resolution.z);
+	volume.sphere_center = center;
+	volume.sphere_radius = radius;
+	volume.sphere_noise = noise;
+
+	const vec3 voxel_size = (grid.bounds_max - grid.bounds_min) / vec3(grid.resolution);
+	const float noise_frequency = 4.0f / radius;
+#pragma omp parallel for
+	for(int z = 0; z < grid.resolution.z; z++)
+	{
+		for(int y = 0; y < grid.resolution.y; y++)
+		{
+			for(int x = 0; x < grid.resolution.x; x++)
+			{
+				const vec3 p = grid.bounds_min + (vec3(x, y, z) + 0.5f) * voxel_size;
+				float density = length(p - center) <= radius ? 1.0f : 0.0f;
+				if(noise > 0.0f)
+				{
+					const float n = fractalNoise(p * noise_frequency);
+					density *= std::max(0.0f, 1.0f - noise + noise * 2.0f * n);
+				}
+				grid.density[(size_t(z) * grid.resolution.y + y) * grid.resolution.x + x] = density;
+			}
+		}
+	}
+	grid.max_density = *std::max_element(grid.density.begin(), grid.density.end());
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Ratio tracking: step through the volume with exponentially distributed
+// distances of the majorant, and multiply in the probability of each
+// collision being a null collision.
+///////////////////////////////////////////////////////////////////////////
+float volumeTransmittance(const vec3& o, const vec3& d, float tmax)
+{
+	const float majorant = volume.density_multiplier * volume.grid.max_density;
+	float t = 0.0f, t1 = tmax;
+	if(majorant <= 0.0f || !volume.grid.clip(o, d, t, t1))
+	{
+		return 1.0f;
+	}
+	float transmittance = 1.0f;
+	while(true)
+	{
+		t -= log(1.0f - randf()) / majorant;
+		if(t >= t1)
+		{
+			return transmittance;
+		}
+		const float sigma_t = volume.density_multiplier * volume.grid.lookup(o + t * d);
+		transmittance *= 1.0f - sigma_t / majorant;
+		// Russian roulette on paths that are almost opaque
+		if(transmittance < 0.1f)
+		{
+			if(randf() >= transmittance / 0.1f)
+			{
+				return 0.0f;
+			}
+			transmittance = 0.1f;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Henyey-Greenstein phase function
+///////////////////////////////////////////////////////////////////////////
+static float phaseHG(float cos_theta, float g)
+{
+	const float denominator = 1.0f + g * g - 2.0f * g * cos_theta;
+	return (1.0f - g * g) / (4.0f * M_PI * denominator * sqrt(denominator));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Light scattered towards -d at x, from the point light
+///////////////////////////////////////////////////////////////////////////
+static vec3 singleScattering(const vec3& x, const vec3& d)
+{
+	const vec3 to_light = point_light.position - x;
+	const float distance_to_light = length(to_light);
+	const vec3 wi = to_light / distance_to_light;
+	Ray shadow_ray(x, wi, 0.0f, distance_to_light);
+	if(occluded(shadow_ray))
+	{
+		return vec3(0.0f);
+	}
+	const float transmittance = volumeTransmittance(x, wi, distance_to_light);
+	const vec3 Li = point_light.intensity_multiplier * point_light.color
+	                / (distance_to_light * distance_to_light);
+	return phaseHG(dot(d, wi), volume.anisotropy) * transmittance * Li;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Delta tracking: the first real collision is a scattering event with
+// probability albedo, the rest is absorption. Without a collision the
+// surface radiance is transmitted unchanged.
+///////////////////////////////////////////////////////////////////////////
+vec3 Lvolume(const Ray& ray, float tmax, const vec3& L_surface)
+{
+	const float majorant = volume.density_multiplier * volume.grid.max_density;
+	float t = ray.tnear, t1 = tmax;
+	if(majorant <= 0.0f || !volume.grid.clip(ray.o, ray.d, t, t1))
+	{
+		return L_surface;
+	}
+	while(true)
+	{
+		t -= log(1.0f - randf()) / majorant;
+		if(t >= t1)
+		{
+			return L_surface;
+		}
+		const vec3 x = ray.o + t * ray.d;
+		const float sigma_t = volume.density_multiplier * volume.grid.lookup(x);
+		if(randf() < sigma_t / majorant)
+		{
+			return volume.albedo * singleScattering(x, ray.d);
+		}
+	}
+}
+} // namespace pathtracer
@@ -0,0 +1,69 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "embree.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Densities on a regular grid over an axis aligned box. The densities are
+// stored at the voxel centers and interpolated trilinearly. Outside the
+// box the density is zero.
+///////////////////////////////////////////////////////////////////////////
+struct DensityGrid
+{
+	glm::ivec3 resolution = glm::ivec3(0);
+	glm::vec3 bounds_min = glm::vec3(0.0f);
+	glm::vec3 bounds_max = glm::vec3(0.0f);
+	std::vector<float> density;
+	// The largest density in the grid, used as the majorant when tracking
+	float max_density = 0.0f;
+
+	float lookup(const glm::vec3& p) const;
+	// The part [t0, t1] of the ray o + t * d that is inside the box, if any
+	bool clip(const glm::vec3& o, const glm::vec3& d, float& t0, float& t1) const;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// A heterogeneous participating medium in front of the surfaces. It is
+// lit by single scattering from the point light.
+///////////////////////////////////////////////////////////////////////////
+struct Volume
+{
+	bool enabled;
+	// The extinction coefficient is density_multiplier * grid density
+	float density_multiplier;
+	// Scattering coefficient / extinction coefficient
+	glm::vec3 albedo;
+	// Henyey-Greenstein asymmetry parameter, 0 = isotropic
+	float anisotropy;
+	// The sphere the grid was created from (see createSphereVolume)
+	glm::vec3 sphere_center;
+	float sphere_radius;
+	float sphere_noise;
+	DensityGrid grid;
+};
+extern Volume volume;
+
+///////////////////////////////////////////////////////////////////////////
+// Fill volume.grid with a sphere of unit density, like the volumetric
+// sphere in lab5. With noise > 0 the density is modulated by fractal
+// value noise, to make it heterogeneous.
+///////////////////////////////////////////////////////////////////////////
+void createSphereVolume(const glm::vec3& center, float radius, float noise, int resolution);
+
+///////////////////////////////////////////////////////////////////////////
+// Transmittance of the volume along the ray o + t * d for t in [0, tmax]
+// (ratio tracking).
+///////////////////////////////////////////////////////////////////////////
+float volumeTransmittance(const glm::vec3& o, const glm::vec3& d, float tmax);
+
+///////////////////////////////////////////////////////////////////////////
+// Radiance arriving at the origin of `ray`, given that L_surface leaves
+// the surface at distance tmax (FLT_MAX for the environment) towards the
+// origin. Delta tracking picks either a scattering event in the volume,
+// where single scattering from the point light is evaluated, or passes
+// L_surface through.
+///////////////////////////////////////////////////////////////////////////
+glm::vec3 Lvolume(const Ray& ray, float tmax, const glm::vec3& L_surface);
+} // namespace pathtracer
@@ -0,0 +1,353 @@
+#include "wavefront.h"
+#include <algorithm>
+#include <vector>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "integrator.h"
+#include "sampling.h"
+#include "volume.h"
+#include "profiler.h"
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// The state of the paths in flight, as a structure of arrays. The paths
+// that are still alive are kept at the front. Path i has the shadow ray
+// slots MAX_SHADOW_RAYS * i and up.
+///////////////////////////////////////////////////////////////////////////
+struct PathQueue
+{
+	// The sample the path belongs to, and the next dimension it draws
+	std::vector<uint32_t> pixel;
+	std::vector<uint32_t> sample_index;
+	std::vector<uint32_t> dimension;
+	// The ray that extends the path, and the number of bounces before it
+	std::vector<Ray> rays;
+	std::vector<int> bounce;
+	// Distance from the camera to the last hit, for texture filtering
+	std::vector<float> path_length;
+	std::vector<vec3> throughput;
+	std::vector<vec3> radiance;
+	// The camera ray and the distance to its hit (FLT_MAX if it missed),
+	// for the volume
+	std::vector<vec3> primary_direction;
+	std::vector<float> primary_distance;
+	// Cleared when the path ends
+	std::vector<uint8_t> alive;
+	// Shadow rays of the last shaded vertex, and the radiance (already
+	// multiplied by the throughput) they add if they are not occluded
+	std::vector<uint8_t> shadow_count;
+	std::vector<Ray> shadow_rays;
+	std::vector<vec3> shadow_L;
+
+	void resize(int size)
+	{
+		pixel.resize(size);
+		sample_index.resize(size);
+		dimension.resize(size);
+		rays.resize(size);
+		bounce.resize(size);
+		path_length.resize(size);
+		throughput.resize(size);
+		radiance.resize(size);
+		primary_direction.resize(size);
+		primary_distance.resize(size);
+		alive.resize(size);
+		shadow_count.resize(size);
+		shadow_rays.resize(size_t(size) * MAX_SHADOW_RAYS);
+		shadow_L.resize(size_t(size) * MAX_SHADOW_RAYS);
+	}
+	int size() const
+	{
+		return int(pixel.size());
+	}
+	// Move path `from` to slot `to` (the shadow rays are not moved)
+	void move(int from, int to)
+	{
+		pixel[to] = pixel[from];
+		sample_index[to] = sample_index[from];
+		dimension[to] = dimension[from];
+		rays[to] = rays[from];
+		bounce[to] = bounce[from];
+		path_length[to] = path_length[from];
+		throughput[to] = throughput[from];
+		radiance[to] = radiance[from];
+		primary_direction[to] = primary_direction[from];
+		primary_distance[to] = primary_distance[from];
+		alive[to] = alive[from];
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Run body(begin, end) over [0, count) in batches of `batch_size`, which
+// the threads take in turn
+///////////////////////////////////////////////////////////////////////////
+template<typename Body>
+static void forEachBatch(int count, int batch_size, const Body& body)
+{
+	const int batches = (count + batch_size - 1) / batch_size;
+#pragma omp parallel for schedule(dynamic, 1)
+	for(int b = 0; b < batches; b++)
+	{
+		body(b * batch_size, std::min((b + 1) * batch_size, count));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Start a camera path for each of `pixels` in the slots from `first` on
+///////////////////////////////////////////////////////////////////////////
+static void generatePaths(PathQueue& queue,
+                          int first,
+                          const uint32_t* pixels,
+                          int count,
+                          int batch_size,
+                          const vec3& camera_pos,
+                          const mat4& inverse_PV)
+{
+	PROFILE_SCOPE("Generate");
+	forEachBatch(count, batch_size, [&](int begin, int end) {
+		for(int i = begin; i < end; i++)
+		{
+			const int path = first + i;
+			const uint32_t pixel = pixels[i];
+			const int x = int(pixel) % rendered_image.width, y = int(pixel) / rendered_image.width;
+			queue.pixel[path] = pixel;
+			queue.sample_index[path] = rendered_image.pixel_samples[pixel];
+			queue.dimension[path] = 0;
+			queue.rays[path] = generatePrimaryRay(x, y, camera_pos, inverse_PV);
+			queue.bounce[path] = 0;
+			queue.path_length[path] = 0.0f;
+			queue.throughput[path] = vec3(1.0f);
+			queue.radiance[path] = vec3(0.0f);
+			queue.primary_direction[path] = queue.rays[path].d;
+			queue.primary_distance[path] = FLT_MAX;
+			queue.alive[path] = 1;
+		}
+	});
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Find the closest hit of the rays of paths [0, count)
+///////////////////////////////////////////////////////////////////////////
+static void extendPaths(PathQueue& queue, int count, int batch_size, int packet_size)
+{
+	PROFILE_SCOPE("Extend");
+	forEachBatch(count, batch_size, [&](int begin, int end) {
+		for(int i = begin; i < end; i += packet_size)
+		{
+			const int n = std::min(packet_size, end - i);
+			if(n > 1)
+			{
+				intersect(&queue.rays[i], n);
+			}
+			else
+			{
+				intersect(queue.rays[i]);
+			}
+		}
+	});
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Shade the hits of paths [0, count): record their shadow rays, and
+// either set up the next ray or end the path
+///////////////////////////////////////////////////////////////////////////
+static void shadePaths(PathQueue& queue, int count, int batch_size)
+{
+	PROFILE_SCOPE("Shade");
+	forEachBatch(count, batch_size, [&](int begin, int end) {
+		for(int i = begin; i < end; i++)
+		{
+			const Ray& ray = queue.rays[i];
+			queue.shadow_count[i] = 0;
+			if(ray.geomID == RTC_INVALID_GEOMETRY_ID)
+			{
+				// A camera ray sees the environment. For later rays it has
+				// already been sampled as a light.
+				if(queue.bounce[i] == 0)
+				{
+					queue.radiance[i] = Lenvironment(ray.d, pixel_spread_angle);
+				}
+				queue.alive[i] = 0;
+				continue;
+			}
+			if(queue.bounce[i] == 0)
+			{
+				queue.primary_distance[i] = ray.tfar;
+			}
+			queue.path_length[i] += ray.tfar;
+			beginSample(queue.pixel[i], queue.sample_index[i], settings.sampler, queue.dimension[i]);
+			const PathVertex vertex = shadeVertex(ray, queue.path_length[i], queue.bounce[i]);
+			queue.dimension[i] = sampleDimension();
+
+			const vec3 throughput = queue.throughput[i];
+			queue.radiance[i] += throughput * vertex.emitted;
+			for(int j = 0; j < vertex.shadow_count; j++)
+			{
+				queue.shadow_rays[i * MAX_SHADOW_RAYS + j] = vertex.shadow_rays[j];
+				queue.shadow_L[i * MAX_SHADOW_RAYS + j] = throughput * vertex.shadow_L[j];
+			}
+			queue.shadow_count[i] = uint8_t(vertex.shadow_count);
+			if(vertex.scattered)
+			{
+				queue.rays[i] = vertex.next_ray;
+				queue.throughput[i] = throughput * vertex.weight;
+				queue.bounce[i]++;
+			}
+			else
+			{
+				queue.alive[i] = 0;
+			}
+		}
+	});
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Trace the shadow rays in the listed slots. Since the slots are not
+// contiguous, each packet is gathered into a local array and the results
+// are scattered back.
+///////////////////////////////////////////////////////////////////////////
+static void traceShadowRays(PathQueue& queue,
+                            const std::vector<uint32_t>& slots,
+                            int batch_size,
+                            int packet_size)
+{
+	PROFILE_SCOPE("Shadow");
+	forEachBatch(int(slots.size()), batch_size, [&](int begin, int end) {
+		Ray rays[MAX_RAY_PACKET_SIZE];
+		for(int i = begin; i < end; i += packet_size)
+		{
+			const int n = std::min(packet_size, end - i);
+			if(n == 1)
+			{
+				occluded(queue.shadow_rays[slots[i]]);
+				continue;
+			}
+			for(int j = 0; j < n; j++)
+			{
+				rays[j] = queue.shadow_rays[slots[i + j]];
+			}
+			occluded(rays, n);
+			for(int j = 0; j < n; j++)
+			{
+				queue.shadow_rays[slots[i + j]].geomID = rays[j].geomID;
+			}
+		}
+	});
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Add the light of the unoccluded shadow rays to paths [0, count), and
+// accumulate the paths that have ended to their pixels. Every pixel has
+// at most one path in flight, so they can be written without locking.
+///////////////////////////////////////////////////////////////////////////
+static void accumulatePaths(PathQueue& queue, int count, int batch_size, const vec3& camera_pos)
+{
+	PROFILE_SCOPE("Accumulate");
+	forEachBatch(count, batch_size, [&](int begin, int end) {
+		for(int i = begin; i < end; i++)
+		{
+			for(int j = 0; j < queue.shadow_count[i]; j++)
+			{
+				if(queue.shadow_rays[i * MAX_SHADOW_RAYS + j].geomID == RTC_INVALID_GEOMETRY_ID)
+				{
+					queue.radiance[i] += queue.shadow_L[i * MAX_SHADOW_RAYS + j];
+				}
+			}
+			if(queue.alive[i])
+			{
+				continue;
+			}
+			vec3 color = queue.radiance[i];
+			if(volume.enabled)
+			{
+				// Attenuate the radiance and add light scattered by the
+				// volume, with the random numbers that follow the path's
+				beginSample(queue.pixel[i], queue.sample_index[i], settings.sampler, queue.dimension[i]);
+				const Ray primary_ray(camera_pos, queue.primary_direction[i]);
+				color = Lvolume(primary_ray, queue.primary_distance[i], color);
+			}
+			accumulateSample(int(queue.pixel[i]), color);
+		}
+	});
+}
+
+int traceWavefront(const vec3& camera_pos, const mat4& inverse_PV)
+{
+	static PathQueue queue;
+	static std::vector<uint32_t> pixels;
+	static std::vector<uint32_t> shadow_slots;
+	const int queue_size = std::max(settings.wavefront_queue_size, 1);
+	const int batch_size = std::max(settings.wavefront_batch_size, 1);
+	const int packet_size = std::max(std::min(settings.ray_packet_size, MAX_RAY_PACKET_SIZE), 1);
+	if(queue.size() != queue_size)
+	{
+		queue.resize(queue_size);
+	}
+
+	// The pixels that get a sample in this pass
+	pixels.clear();
+	for(int y = 0; y < rendered_image.height; y++)
+	{
+		for(int x = 0; x < rendered_image.width; x++)
+		{
+			if(isPixelActive(x, y))
+			{
+				pixels.push_back(uint32_t(y * rendered_image.width + x));
+			}
+		}
+	}
+
+	int active_pixels = 0;
+	int path_count = 0;
+	size_t next_pixel = 0;
+	while(path_count > 0 || next_pixel < pixels.size())
+	{
+		// Refill the queue with camera paths, so that the stages always
+		// have as many paths to work on as possible
+		const int new_paths = int(std::min(size_t(queue_size - path_count), pixels.size() - next_pixel));
+		generatePaths(queue, path_count, pixels.data() + next_pixel, new_paths, batch_size, camera_pos,
+		              inverse_PV);
+		path_count += new_paths;
+		next_pixel += new_paths;
+
+		extendPaths(queue, path_count, batch_size, packet_size);
+		shadePaths(queue, path_count, batch_size);
+
+		shadow_slots.clear();
+		for(int i = 0; i < path_count; i++)
+		{
+			for(int j = 0; j < queue.shadow_count[i]; j++)
+			{
+				shadow_slots.push_back(uint32_t(i * MAX_SHADOW_RAYS + j));
+			}
+		}
+		traceShadowRays(queue, shadow_slots, batch_size, packet_size);
+		accumulatePaths(queue, path_count, batch_size, camera_pos);
+
+		// Remove the paths that have ended, keeping the order of the rest
+		int alive_count = 0;
+		for(int i = 0; i < path_count; i++)
+		{
+			if(queue.alive[i])
+			{
+				if(i != alive_count)
+				{
+					queue.move(i, alive_count);
+				}
+				alive_count++;
+			}
+			else
+			{
+				const int x = int(queue.pixel[i]) % rendered_image.width;
+				const int y = int(queue.pixel[i]) / rendered_image.width;
+				active_pixels += isPixelActive(x, y) ? 1 : 0;
+			}
+		}
+		path_count = alive_count;
+	}
+	return active_pixels;
+}
+} // namespace pathtracer
@@ -0,0 +1,26 @@
+#pragma once
+#include <glm/glm.hpp>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Wavefront integrator. Instead of following one path at a time to its
+// end, a queue of up to settings.wavefront_queue_size paths is advanced
+// one stage at a time:
+//   generate:   start camera paths in the free slots of the queue
+//   extend:     find the next hit of every path (Embree packets)
+//   shade:      shade the hits, sample the lights and the next directions
+//   shadow:     trace the shadow rays of all paths (Embree packets)
+//   accumulate: add the unoccluded light, and write finished paths to
+//               their pixels
+// Each stage runs over the whole queue in batches of
+// settings.wavefront_batch_size paths that are spread over the threads,
+// so a stage keeps its code and data in cache, and the rays it traces
+// are grouped into packets however divergent the paths have become.
+//
+// Takes one sample of every active pixel, like the tiled integrator, and
+// renders the same image. Returns the number of pixels that still need
+// more samples.
+///////////////////////////////////////////////////////////////////////////
+int traceWavefront(const glm::vec3& camera_pos, const glm::mat4& inverse_PV);
+} // namespace pathtracer
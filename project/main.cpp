@@ -11,6 +11,7 @@ extern "C" _declspec(dllexport) unsigned int NvOptimusEnablement = 0x00000001;
 #include <chrono>
 
 #include <labhelper.h>
+#include <profiler.h>
 #include <imgui.h>
 #include <imgui_impl_sdl_gl3.h>
 
@@ -283,14 +284,26 @@ void display(void)
 	///////////////////////////////////////////////////////////////////////////
 	// Draw from camera
 	///////////////////////////////////////////////////////////////////////////
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0, 0, windowWidth, windowHeight);
-	glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	{
+		PROFILE_GPU_SCOPE("Clear");
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, windowWidth, windowHeight);
+		glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
 
-	drawBackground(viewMatrix, projMatrix);
-	drawScene(shaderProgram, viewMatrix, projMatrix, lightViewMatrix, lightProjMatrix);
-	debugDrawLight(viewMatrix, projMatrix, vec3(lightPosition));
+	{
+		PROFILE_GPU_SCOPE("Background");
+		drawBackground(viewMatrix, projMatrix);
+	}
+	{
+		PROFILE_GPU_SCOPE("Scene");
+		drawScene(shaderProgram, viewMatrix, projMatrix, lightViewMatrix, lightProjMatrix);
+	}
+	{
+		PROFILE_GPU_SCOPE("Debug light");
+		debugDrawLight(viewMatrix, projMatrix, vec3(lightPosition));
+	}
 
 
 
@@ -432,7 +445,10 @@ int main(int argc, char* argv[])
 		ImGui_ImplSdlGL3_NewFrame(g_window);
 
 		// check events (keyboard among other)
-		stopRendering = handleEvents();
+		{
+			PROFILE_SCOPE("Events");
+			stopRendering = handleEvents();
+		}
 
 		// render to window
 		display();
@@ -440,14 +456,31 @@ int main(int argc, char* argv[])
 		// Render overlay GUI.
 		if(showUI)
 		{
+			PROFILE_SCOPE("GUI layout");
 			gui();
+			labhelper::profilerGui();
 		}
 
 		// Render the GUI.
-		ImGui::Render();
+		{
+			PROFILE_GPU_SCOPE("GUI");
+			ImGui::Render();
+		}
 
 		// Swap front and back buffer. This frame will now been displayed.
-		SDL_GL_SwapWindow(g_window);
+		{
+			PROFILE_SCOPE("Swap");
+			SDL_GL_SwapWindow(g_window);
+		}
+
+		// Write out screenshots that have been read back
+		{
+			PROFILE_SCOPE("Screenshots");
+			labhelper::pollScreenshots();
+		}
+
+		// Collect this frame's timings
+		labhelper::profilerNewFrame();
 	}
 	// Free Models
 	labhelper::freeModel(fighterModel);